@@ -2,458 +2,4584 @@
 Possible parameters are:
 -user       finds directory entries of a given user
 -name       finds directory entries with a file name matching the supplied pattern
+-iname      like -name, but letters match in either case
+-path       finds directory entries whose whole path matches the supplied pattern, '*' and '?' also match '/'
+-ipath      like -path, but letters match in either case
+-wholename  the same as -path, -iwholename the same as -ipath
+-regex      finds directory entries whose whole path matches the supplied regular expression.
+            Expressions use the POSIX extended syntax of find -regextype posix-extended, not
+            the emacs syntax find uses by default: '\./src/(aa|abab)' matches ./src/aa here,
+            while find without -regextype only matches a file named "(aa|abab)"
+-iregex     like -regex, but letters match in either case
 -type       finds directory entries of a given type
 -print      prints the name of the directory to stdout
--ls         similiar to -ls command in CLI */
+-ls         similiar to -ls command in CLI
+-prune      true, keeps the walk out of a directory it is evaluated for. It is no
+            action, so the default -print still applies unless -print or -ls is given
+Tests and actions can be combined with the operators ( ), ! or -not,
+-a or -and and -o or -or. Without an operator -a is implied.
+-dirbuf     size of the buffer used to read directories, eg.: 64K or 1M
+-stats      prints counters about the traversal to stderr when done
+-threads    number of threads traversing directories in parallel
+-ordered    prints in the same order as a single threaded traversal when using -threads
+-uring      queue depth for fetching file information in batches through io_uring, 0 disables it
+-linebuffered writes every line out immediately, the default when stdout is a terminal
+-maxfds     directories every thread keeps open at most, by default the open file limit split between threads
+-maxdepth   descends at most this many levels below the start path, which is depth 0
+-mindepth   tests and acts on no entries above this depth
+            Both are global options like in find, no matter where they are
+            given they apply to the whole walk and evaluate to true. */
+
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <dirent.h>
 #include <errno.h>
 #include <error.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
 #include <fnmatch.h>
+#include <regex.h>
+#include <ctype.h>
 #include <libgen.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #define MAXPATHLENGTH 4096
+#define DIRBUFMIN (32 * 1024)
+#define DIRBUFDEFAULT (1024 * 1024)
+#define MAXTHREADS 256
+#define NAMEBUFLENGTH 1024
+#define NAMECACHEMIN 64
+#define OUTPUTCHUNKSIZE (64 * 1024)
+#define OUTPUTBUFFERSIZE (256 * 1024)
+#define PATHBLOCKSIZE (64 * 1024)
+#define STARTPATH SIZE_MAX
+#define LSHEADLENGTH 1024
+#define MAXURINGDEPTH 1024
+#define GLOBMAXTOKENS 63
+#define ORDEREDBUFFERLIMIT (16 * 1024 * 1024)
+#define FDRESERVE 64
+#define DFAMAXSTATES 4096
+#define MINOPENDIRS 2
+#define REGEXMAXSTATES 512
+#define REGEXMAXNODES 4096
+#define REGEXMAXDEPTH 256
+
+/* File information is fetched with statx, which lets the filesystem skip the
+fields no test asks for (see planStatxMask) */
+typedef struct statx FileInfo;
+
+/* Parameters are compiled into a flat program of instructions which is run
+for every entry. Operands are decoded once while parsing, so evaluating an
+entry never compares strings to find out what to do. Every instruction sets
+the result register, the jumps implement the short circuit of -a and -o. */
+typedef enum opcode {
+    OP_PRINT,
+    OP_LS,
+    OP_PRUNE,
+    OP_USER,
+    OP_TYPE,
+    OP_NAME,
+    OP_NAME_SET,
+    OP_PATH,
+    OP_REGEX,
+    OP_TRUE,
+    OP_NOT,
+    OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE
+} Opcode;
+
+// How a -name pattern is matched, chosen once while parsing
+typedef enum matchKind {
+    MATCH_LITERAL,          // no wildcards, compared with strcmp
+    MATCH_PREFIX,           // "text*"
+    MATCH_SUFFIX,           // "*text", like "*.log"
+    MATCH_CONTAINS,         // "*text*"
+    MATCH_GLOB,             // any other pattern, run on a GlobNfa
+    MATCH_FNMATCH,          // what GlobNfa does not support, like [[:alpha:]]
+    // The same for -iname with the text in lower case, folded globs are MATCH_GLOB
+    MATCH_FOLDED_LITERAL,
+    MATCH_FOLDED_PREFIX,
+    MATCH_FOLDED_SUFFIX,
+    MATCH_FOLDED_CONTAINS,
+    MATCH_FOLDED_FNMATCH
+} MatchKind;
+
+/* A compiled glob of up to GLOBMAXTOKENS characters, '?' and [...] classes
+with any number of '*' between them. Bit i of the state is set while the
+first i tokens matched. Every character moves the state one token further
+where the token accepts it, states followed by a '*' also stay set. For
+-iname a token accepts both cases of a letter, so folding costs nothing. */
+typedef struct globNfa {
+    uint64_t accepts[256];  // bit i + 1 is set if token i accepts the character
+    uint64_t loops;         // states followed by a '*'
+    uint64_t final;         // the state after the last token
+} GlobNfa;
+
+// A -name or -iname pattern, compiled once while parsing
+typedef struct namePattern {
+    const char* pattern;
+    MatchKind kind;
+    const char* text;       // the fixed part of MATCH_LITERAL to MATCH_CONTAINS and their folded kinds
+    size_t length;
+    const GlobNfa* nfa;     // all kinds but the fnmatch() ones
+    char block[16];         // text padded with zeros for vector loads, if it fits
+} NamePattern;
+
+/* A trie over the fixed parts of several patterns. Bytes that occur in none
+of them share column 0, which keeps the transition table small. Node 0 is the
+root and never the target of an edge, so 0 also stands for no transition. */
+typedef struct nameTrie {
+    uint8_t columns[256];   // the column of every byte
+    size_t columnCount;
+    uint32_t* next;         // columnCount transitions per node
+    bool* terminal;         // a pattern ends at the node
+    size_t nodeCount;
+} NameTrie;
+
+/* A DFA built while it runs, from an automaton whose states are bit vectors
+of words words. Every DFA state stands for one set of automaton states, its
+transitions are computed on first use. They are shared by all threads, read
+without a lock and only added under it. Once DFAMAXSTATES states exist, new
+sets are stepped on the automaton without being cached. State 0 is the empty
+set, state 1 the start. */
+typedef struct lazyDfa {
+    size_t words;
+    void (*step)(const void* automaton, const uint64_t* from, unsigned char c, uint64_t* to);
+    const void* automaton;
+    const uint64_t* finals;     // a set accepts if it has one of these
+    pthread_mutex_t lock;
+    uint64_t* sets;             // words per state
+    bool* accepting;
+    atomic_int* rows[DFAMAXSTATES]; // 256 transitions of every state, -1 until computed
+    int* table;                 // hash of the sets to their states, -1 for free slots
+    size_t tableMask;
+    int stateCount;
+} LazyDfa;
+
+/* The NFAs of several globs side by side, each starting at a state of its
+own. The final state of a glob shifts into the start state of the next one,
+which accepts no character, so the globs never run into each other. The
+NFA is only stepped to build the DFA. */
+typedef struct globSet {
+    size_t words;           // 64 states per word
+    uint64_t* accepts;      // words per character
+    uint64_t* loops;
+    uint64_t* starts;
+    uint64_t* finals;
+    LazyDfa dfa;
+} GlobSet;
+
+/* The -name patterns of one -o group, matched together so the cost of a name
+hardly grows with the number of patterns. Literals are looked up in a hash
+table, prefixes and suffixes walk a trie from either end of the name,
+substrings run on an Aho-Corasick automaton and globs on one GlobSet. */
+typedef struct nameSet {
+    bool matchAll;          // one of the patterns is "*"
+    const char** literals;  // open addressing, literalMask + 1 slots
+    uint64_t* literalHashes; // the hash of every literal, compared before the names
+    size_t literalMask;
+    NameTrie* prefixes;     // NULL where there are no patterns of the kind
+    NameTrie* suffixes;     // built from the reversed suffixes
+    NameTrie* contains;     // with the failure transitions filled in
+    GlobSet* globs;         // NULL without patterns that runsAsGlob()
+    NamePattern* others;    // left to fnmatch() one by one
+    size_t otherCount;
+} NameSet;
+
+// A -path pattern and its slot in the NFA states every directory keeps for the -path tests
+typedef struct pathTest {
+    NamePattern pattern;
+    size_t slot;
+} PathTest;
+
+/* A regular expression as a position automaton: every character class of the
+expression is a state of its own, state 0 is the start. A character moves a
+set of states to the states that may follow one of them and accept it. Counted
+repeats are expanded into copies, so the automaton needs no counters. It is
+only stepped to build the DFA. */
+typedef struct regexNfa {
+    size_t words;           // 64 states per word
+    uint64_t* accepts;      // words per character
+    uint64_t* follows;      // words per state
+    uint64_t* starts;
+    uint64_t* finals;
+    LazyDfa dfa;
+} RegexNfa;
+
+/* A -regex or -iregex expression, compiled once while parsing. What the
+position automaton does not support is left to re_match(). Before a whole
+path is matched it is searched for a string every match contains. */
+typedef struct regexTest {
+    const char* pattern;
+    RegexNfa* nfa;          // NULL if the expression runs on re_match()
+    regex_t* compiled;      // for re_match(), NULL if there is an NFA
+    NamePattern prefilter;  // a MATCH_CONTAINS or MATCH_FOLDED_CONTAINS pattern
+    bool filtered;          // there is a prefilter
+    size_t slot;            // like PathTest.slot, the DFA state after the directory
+} RegexTest;
+
+/* The parse tree of a regular expression. x+ and x? are written as xx* and
+(x|), so classes, concatenation, alternation and the star are enough. */
+typedef enum regexKind {
+    REGEX_CLASS,
+    REGEX_EMPTY,
+    REGEX_CONCAT,
+    REGEX_ALTERNATE,
+    REGEX_STAR
+} RegexKind;
+
+typedef struct regexNode {
+    RegexKind kind;
+    uint64_t accepts[4];        // REGEX_CLASS, the characters it accepts
+    struct regexNode* left;     // operand of REGEX_STAR
+    struct regexNode* right;
+} RegexNode;
+
+typedef struct regexParser {
+    const char* pos;
+    const char* end;
+    bool folded;
+    bool unsupported;           // the expression is left to re_match()
+    size_t nodes;
+    size_t depth;               // of open parentheses
+} RegexParser;
+
+typedef struct instruction {
+    Opcode op;
+    union {
+        uid_t uid;              // OP_USER
+        mode_t fileType;        // OP_TYPE, one of the S_IFMT types
+        NamePattern name;       // OP_NAME
+        const NameSet* names;   // OP_NAME_SET
+        PathTest path;          // OP_PATH
+        const RegexTest* regex; // OP_REGEX
+        size_t target;          // OP_JUMP_IF_FALSE, OP_JUMP_IF_TRUE
+    } arg;
+} Instruction;
+
+typedef struct program {
+    Instruction* code;
+    size_t length;
+    size_t capacity;
+    size_t pathTests;       // number of OP_PATH and OP_REGEX instructions
+} Program;
+
+/* The expression is parsed into a tree first, so the optimizer can reorder
+operands before it is compiled into a program */
+typedef enum exprKind {
+    EXPR_PRIMARY,
+    EXPR_NOT,
+    EXPR_AND,
+    EXPR_OR
+} ExprKind;
+
+typedef struct exprNode {
+    ExprKind kind;
+    Instruction primary;        // EXPR_PRIMARY
+    struct exprNode* left;      // operand of EXPR_NOT, left operand of EXPR_AND and EXPR_OR
+    struct exprNode* right;
+    double cost;                // estimated cost of evaluating the node
+    double probability;         // estimated probability that the node is true
+    bool sideEffects;           // contains an action and must keep its position
+} ExprNode;
+
+typedef struct parser {
+    int argc;
+    char** argv;
+    int pos;
+    bool hasAction;
+    size_t pathTests;
+} Parser;
+
+/* Record layout returned by the getdents64 system call. Records are packed
+back to back in the read buffer, d_reclen is the offset to the next one. */
+typedef struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} LinuxDirent64;
+
+/* Read buffers are kept on a free list and reused by the next directory
+that is opened, so a walk only allocates as many buffers as the tree is
+deep. A buffer starts small and grows up to options.dirBufferSize once a
+directory fills it. */
+typedef struct dirBuffer {
+    char* data;
+    size_t size;
+    struct dirBuffer* next;
+} DirBuffer;
+
+// Reads the records of one directory through getdents64
+typedef struct dirReader {
+    int fd;
+    DirBuffer* buff;
+    size_t pos;     // offset of the next record in buff
+    size_t len;     // number of bytes filled by the last read
+    bool eof;
+} DirReader;
+
+/* An io_uring instance set up with the raw system calls. Every thread has its
+own, so submissions never need a lock. */
+typedef struct uring {
+    int fd;
+    unsigned int entries;
+    unsigned int* sqHead;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} Uring;
+
+// What a parameter needs to know about a file, ordered from cheapest to most expensive
+typedef enum fileInfoNeed {
+    NEED_NOTHING,   // works on the name or path alone
+    NEED_TYPE,      // needs the file type, which d_type usually provides
+    NEED_STAT       // needs the full stat information
+} FileInfoNeed;
+
+typedef struct options {
+    size_t dirBufferSize;
+    FileInfoNeed fileInfoNeed;  // the most expensive need of all parameters
+    unsigned int statxMask;     // STATX_* fields needed by the program
+    bool printStats;
+    unsigned int threads;
+    bool ordered;
+    unsigned int uringDepth;    // 0 fetches file information synchronously
+    bool lineBuffered;
+    unsigned long maxOpenDirs;  // per thread, 0 until derived from the open file limit
+    size_t maxDepth;            // directories at this depth are not opened, SIZE_MAX without -maxdepth
+    size_t minDepth;            // entries above this depth are not tested
+} Options;
+
+// Counters printed by -stats
+typedef struct stats {
+    unsigned long entries;
+    unsigned long statCalls;
+    unsigned long directories;
+    unsigned long dirReads;
+    unsigned long uringSubmits;
+    unsigned long nameCacheHits;
+    unsigned long nameCacheMisses;
+    unsigned long reopens;
+} Stats;
+
+/* Maps user or group IDs to names for -ls, so the user and group databases
+(which may be LDAP or sssd behind NSS) are asked only once per ID. IDs
+without a name are cached too. Open addressing with linear probing. */
+typedef struct nameCacheSlot {
+    uint32_t id;
+    bool used;
+    char* name;             // NULL if the ID has no name
+} NameCacheSlot;
+
+typedef struct nameCache {
+    NameCacheSlot* slots;
+    size_t capacity;        // always a power of two
+    size_t count;
+    bool groups;            // looks up groups instead of users
+} NameCache;
+
+static Options options = {
+    .dirBufferSize = DIRBUFDEFAULT,
+    .fileInfoNeed = NEED_NOTHING,
+    .statxMask = STATX_TYPE,
+    .printStats = false,
+    .threads = 1,
+    .ordered = false,
+    .uringDepth = 0,
+    .lineBuffered = false,
+    .maxOpenDirs = 0,
+    .maxDepth = SIZE_MAX,
+    .minDepth = 0
+};
+
+/* Output is collected in a large buffer per thread and written with write()
+once it is full. Only whole lines are added to it, so lines of different
+threads never interleave. */
+typedef struct outputBuffer {
+    char* data;
+    size_t length;
+} OutputBuffer;
+
+static __thread OutputBuffer threadOutput = { .data = NULL, .length = 0 };
+
+// Keeps the buffers of several workers from being split into each other in a pipe
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Last modification time formatted by printLs, most neighbouring entries share the minute
+static __thread time_t lsTimeMinute;
+static __thread bool lsTimeValid = false;
+static __thread char lsTimeBuff[13];
+struct worker;
+
+/* With -ordered every directory task writes its output into a node instead
+of stdout. A node is a list of items, each either a chunk of text or a link
+to the node of a subdirectory at the position where a sequential traversal
+would have descended into it. The emitter thread walks these nodes depth
+first and writes them out, so the output matches a single threaded run. */
+typedef struct outputItem {
+    char* data;                 // text, NULL for a link
+    size_t length;
+    struct outputNode* child;   // node of a subdirectory, NULL for text
+    struct outputItem* next;
+} OutputItem;
+
+typedef struct outputNode {
+    OutputItem* first;          // guarded by outputQueue.lock
+    OutputItem* last;
+    bool done;                  // the task finished, no more items follow
+    struct worker* owner;       // worker whose deque the task was queued on
+    char* chunk;                // text not yet published, only used by the writing worker
+    size_t chunkLength;
+} OutputNode;
+
+/* Workers that run ahead of the emitter block once bufferedBytes exceeds
+ORDEREDBUFFERLIMIT, unless they write the node the emitter is waiting for.
+While blocked they run that node's task themselves if nobody started it yet,
+so the emitter always makes progress. */
+typedef struct outputQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t itemAdded;   // wakes the emitter
+    pthread_cond_t spaceFreed;  // wakes blocked workers
+    OutputNode* head;           // node the emitter is currently writing
+    size_t bufferedBytes;       // published text not yet written
+    pthread_t emitter;
+} OutputQueue;
+
+static OutputQueue outputQueue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .itemAdded = PTHREAD_COND_INITIALIZER,
+    .spaceFreed = PTHREAD_COND_INITIALIZER,
+    .head = NULL,
+    .bufferedBytes = 0
+};
+
+// Output node the calling thread writes into, NULL to write to stdout directly
+static __thread OutputNode* currentOutput = NULL;
+
+/* Paths of queued directories are copied into blocks that are shared by many
+tasks. A block is freed once its owner moved on to a new block and every task
+stored in it is done, which may happen on any thread. */
+typedef struct pathBlock {
+    atomic_long refs;           // tasks using the block, plus one while it is the current block of a thread
+    size_t used;
+    size_t size;
+    char data[];
+} PathBlock;
+
+/* A directory waiting to be read by one of the workers. In parallel mode
+subdirectories are queued as tasks instead of being descended into. */
+typedef struct task {
+    const char* path;
+    size_t pathLength;
+    PathBlock* block;
+    size_t depth;
+    OutputNode* output;         // only with -ordered
+} Task;
+
+/* Pending tasks of a worker. The owner pushes and pops at the back, so it
+walks its part of the tree depth first, while idle workers steal from the
+front, which holds the oldest and usually largest subtrees. */
+typedef struct taskDeque {
+    pthread_mutex_t lock;
+    Task* tasks;
+    size_t head;            // index of the oldest task
+    size_t count;
+    size_t capacity;
+} TaskDeque;
+
+typedef struct worker {
+    pthread_t thread;
+    unsigned int id;
+    TaskDeque deque;
+    const Program* program;
+} Worker;
+
+typedef struct workerPool {
+    Worker* workers;
+    unsigned int count;
+    atomic_long pending;    // tasks pushed but not finished yet
+    atomic_long queued;     // tasks waiting in a deque
+    atomic_int idle;        // workers waiting for tasks
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+} WorkerPool;
+
+static WorkerPool pool;
+
+/* The path of the entry being evaluated. Descending into a directory appends
+"/name" to it and every entry truncates it back to the length of its parent,
+so a path is never copied as a whole. Pointers into it stay valid until the
+next call of entryPath(). */
+typedef struct pathBuilder {
+    char* data;
+    size_t length;
+    size_t capacity;
+} PathBuilder;
+
+static __thread PathBuilder walkPath = { .data = NULL, .length = 0, .capacity = 0 };
+
+// Block new task paths of this thread are stored in
+static __thread PathBlock* currentPathBlock = NULL;
+
+// The worker running on this thread, NULL for a sequential traversal
+static __thread Worker* currentWorker = NULL;
+
+// Ring of the calling thread, set up on first use, NULL once setting it up failed
+static __thread Uring* threadUring = NULL;
+static __thread bool uringFailed = false;
+
+// Every thread has its own caches, so lookups need no locks
+static __thread NameCache userNames = { .groups = false };
+static __thread NameCache groupNames = { .groups = true };
+
+// Counters are collected per thread and added to totalStats when a thread is done
+static __thread Stats stats;
+static Stats totalStats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A directory entry as seen by the walker. Entries are resolved relative to
+the file descriptor of their parent directory, so the kernel only has to look
+up a single path component per entry. The full path is only built when it is
+actually needed (output, error messages, descending into a directory). */
+typedef struct entry {
+    int dirFd;              // directory the entry name is relative to
+    const char* name;       // name passed to the *at() system calls
+    const char* baseName;   // last path component, matched by -name
+    size_t dirLength;       // length of the parent path in walkPath, STARTPATH for the start path
+    size_t depth;           // 0 for the start path
+    mode_t type;            // file type bits, from d_type or stat, 0 if unknown
+    bool hasInfo;           // info was filled by entryInfo()
+    bool pruned;            // -prune matched, a directory is not descended into
+    FileInfo info;
+} Entry;
+
+// Entries of one directory whose file information is fetched together through io_uring
+typedef struct entryBatch {
+    Entry* entries;
+    struct entryBatch* next;
+} EntryBatch;
+
+/* A directory being read by the walker. Instead of recursing, the walker keeps
+the open directories on a stack of frames on the heap, so the depth of a tree
+is only limited by memory and a walk can stop after any entry and continue
+later. Frames are linked from the innermost directory outwards and reused
+through a free list, so they never move while an entry points into them. */
+typedef struct dirFrame {
+    DirReader reader;
+    size_t pathLength;          // length of the directory path in walkPath
+    size_t depth;               // of the directory, its entries are one deeper
+    EntryBatch* batch;          // entries whose information is fetched through io_uring, NULL without
+    size_t batchCount;
+    size_t batchNext;
+    Entry entry;                // the current entry without io_uring
+    dev_t dev;                  // identity and read offset saved when the directory was closed early
+    ino_t ino;
+    off_t offset;
+    uint64_t* pathStates;       // NFA state of every -path and DFA state of every -regex test after the directory and its '/'
+    bool pathStatesReady;
+    bool parentPath;            // the parent frame holds the parent directory, not a directory of an outer task
+    struct dirFrame* parent;
+    struct dirFrame* child;     // the frame above, valid while it is on the stack
+} DirFrame;
+
+// Innermost directory the thread is reading
+static __thread DirFrame* walkStack = NULL;
+
+/* Like the nfds of fts, only options.maxOpenDirs directories of a thread stay
+open. Beyond that the shallowest open directory of the current walk is
+closed and opened again once the walker returns to it. Directories closed
+this way are always the shallowest ones, so the open frames of a walk are
+the innermost ones from oldestOpen up. */
+static __thread unsigned long openFrames = 0;
+static __thread DirFrame* oldestOpen = NULL;
+static __thread DirFrame* freeFrames = NULL;
+static __thread EntryBatch* freeEntryBatches = NULL;
+
+Program* parseParams(int argc, char* argv[], char* path);
+ExprNode* parseOr(Parser* parser);
+ExprNode* parseAnd(Parser* parser);
+ExprNode* parseUnary(Parser* parser);
+ExprNode* parsePrimary(Parser* parser);
+bool startsOperand(const char* arg);
+const char* nextArgument(Parser* parser);
+ExprNode* createPrimary(Opcode op);
+ExprNode* createNode(ExprKind kind, ExprNode* left, ExprNode* right);
+ExprNode* optimizeExpression(ExprNode* node);
+void estimatePrimary(ExprNode* node);
+void compileExpression(Program* program, const ExprNode* node);
+Instruction* emitInstruction(Program* program, Opcode op);
+bool typeExists(const char* type);
+mode_t decodeType(char type);
+uid_t resolveUser(const char* user);
+NamePattern compilePattern(const char* pattern, bool folded);
+int parseClass(const char* pattern, bool* members, bool folded);
+unsigned char foldCase(unsigned char c);
+bool runGlob(const GlobNfa* nfa, const char* str);
+uint64_t advanceGlob(const GlobNfa* nfa, uint64_t state, const char* str, size_t length);
+bool runsAsGlob(const NamePattern* name);
+NameSet* createNameSet(const NamePattern** patterns, size_t count);
+NameTrie* createTrie(const NamePattern** patterns, size_t count, MatchKind kind);
+void addFailureLinks(NameTrie* trie);
+GlobSet* createGlobSet(const NamePattern** patterns, size_t count);
+uint64_t hashBytes(const void* data, size_t length);
+bool matchNameSet(const NameSet* set, const char* fileName);
+bool matchTrieEnd(const NameTrie* trie, const char* name, size_t length, bool reversed);
+bool matchTrieAnywhere(const NameTrie* trie, const char* name, size_t length);
+void stepGlobSet(const void* automaton, const uint64_t* from, unsigned char c, uint64_t* to);
+void initDfa(LazyDfa* dfa, void (*step)(const void*, const uint64_t*, unsigned char, uint64_t*), const void* automaton, size_t words, const uint64_t* starts, const uint64_t* finals);
+int addDfaState(LazyDfa* dfa, const uint64_t* set);
+int addDfaTransition(LazyDfa* dfa, int state, unsigned char c);
+bool runDfa(LazyDfa* dfa, const char* str);
+int advanceDfa(LazyDfa* dfa, int state, const char* str, size_t length);
+RegexTest* compileRegex(const char* pattern, bool folded);
+RegexNode* parseRegexAlternation(RegexParser* parser);
+RegexNode* parseRegexSequence(RegexParser* parser);
+RegexNode* parseRegexRepeat(RegexParser* parser);
+RegexNode* parseRegexAtom(RegexParser* parser);
+bool parseRegexBracket(RegexParser* parser, uint64_t* accepts);
+bool parseRegexCount(RegexParser* parser, long* count);
+RegexNode* createRegexNode(RegexParser* parser, RegexKind kind, RegexNode* left, RegexNode* right);
+RegexNode* copyRegexNode(RegexParser* parser, const RegexNode* node);
+size_t countRegexNodes(const RegexNode* node);
+size_t countRegexClasses(const RegexNode* node);
+void freeRegexNode(RegexNode* node);
+RegexNfa* createRegexNfa(const RegexNode* root, size_t classes);
+bool linkRegexNode(RegexNfa* nfa, const RegexNode* node, size_t* next, uint64_t* first, uint64_t* last);
+void stepRegex(const void* automaton, const uint64_t* from, unsigned char c, uint64_t* to);
+void findRegexLiteral(const RegexNode* node, bool folded, char* run, size_t* runLength, char* best, size_t* bestLength);
+void selectKernels(void);
+bool containsScalar(const char* str, const NamePattern* name);
+bool containsFoldedScalar(const char* str, const NamePattern* name);
+bool foldedEqualsScalar(const char* str, const char* lower, size_t length);
+#if defined(__x86_64__)
+bool blockReadable(const void* ptr, size_t size);
+bool containsSse42(const char* str, const NamePattern* name);
+bool containsFoldedSse42(const char* str, const NamePattern* name);
+__m128i foldBlock(__m128i block);
+unsigned int foldedMatch16(const char* str, const char* lower);
+bool foldedEqualsSse2(const char* str, const char* lower, size_t length);
+#endif
+FileInfoNeed instructionNeeds(const Instruction* instruction);
+FileInfoNeed planFileInfo(const Program* program);
+unsigned int instructionStatxMask(const Instruction* instruction);
+unsigned int planStatxMask(const Program* program);
+void verifyArgument(int argc, char* argv[], int index);
+void* allocateMemory(size_t size);
+bool stringStartsWith(const char *pre, const char *str);
+bool isNumeric(const char* str);
+bool parseSize(const char* str, size_t* size);
+void doEntry(Entry* entry, const Program* program);
+bool runProgram(const Program* program, Entry* entry);
+const FileInfo* entryInfo(Entry* entry);
+mode_t entryType(Entry* entry);
+void printStats(void);
+void mergeStats(void);
+void runParallel(Entry* start, const Program* program);
+void* runWorker(void* arg);
+void runTask(Worker* worker, Task* task);
+void pushTask(Worker* worker, const char* path, size_t length, size_t depth, OutputNode* output);
+const char* storePath(const char* path, size_t length, PathBlock** block);
+void releasePathBlock(PathBlock* block);
+bool popTask(Worker* worker, Task* task);
+bool stealTask(Worker* thief, Task* task);
+bool claimTask(Worker* owner, OutputNode* output, Task* task);
+bool waitForTask(void);
+OutputNode* createOutputNode(Worker* owner);
+void appendOutputItem(OutputNode* node, char* data, size_t length, OutputNode* child);
+void publishChunk(OutputNode* node);
+void finishOutput(OutputNode* node);
+void* runEmitter(void* arg);
+void writeOutput(const char* data, size_t length);
+void writeLine(const char* head, size_t headLength, const char* path, size_t pathLength);
+void bufferOutput(const char* data, size_t length);
+void flushOutput(void);
+void writeAll(const char* data, size_t length);
+size_t formatNumber(char* dest, unsigned long value, size_t width);
+size_t formatField(char* dest, const char* str, size_t width);
+void printMessage(const char* format, ...);
+void walk(const DirFrame* bottom, const Program* program);
+bool pushDirectory(int parentFd, const char* name, size_t pathLength, size_t depth);
+void popDirectory(void);
+Entry* nextEntry(DirFrame* frame);
+LinuxDirent64* readRecord(DirFrame* frame);
+void initEntry(Entry* entry, const DirFrame* frame, const LinuxDirent64* record);
+bool isDotEntry(const char* name);
+bool fillBatch(DirFrame* frame);
+void noteOpened(DirFrame* frame);
+void evictDirectory(DirFrame* frame);
+bool reopenDirectory(DirFrame* frame);
+bool restoreDirectory(DirFrame* frame, int fd);
+int openPath(int dirFd, const char* path, size_t length);
+unsigned long defaultOpenDirs(void);
+bool needsPrefetch(const Entry* entry);
+void prefetchInfo(Uring* ring, Entry* entries, size_t count);
+Uring* getUring(void);
+bool setupUring(Uring* ring, unsigned int entries);
+void closeUring(void);
+const char* entryPath(Entry* entry);
+const char* truncatePath(size_t length);
+void appendPath(const char* data, size_t length);
+void openDirReader(DirReader* reader, int fd);
+LinuxDirent64* readDirEntry(DirReader* reader);
+void closeDirReader(DirReader* reader);
+void getFilePermissions(mode_t mode, char* bits);
+void printLs(const char* path, const FileInfo* fileInfo);
+void printPath(const char* path);
+bool compPath(const NamePattern* name, const char* fileName);
+bool matchPath(const Program* program, const PathTest* test, Entry* entry);
+void preparePathStates(const Program* program, DirFrame* frame);
+bool matchRegex(const Program* program, const RegexTest* test, Entry* entry);
+bool runRegex(const RegexTest* test, const char* path);
+bool hasNoUser(const FileInfo* fileInfo);
+const char* cachedName(NameCache* cache, uint32_t id);
+NameCacheSlot* findNameSlot(NameCache* cache, uint32_t id);
+char* lookupName(uint32_t id, bool group);
+
+/* Kernels for the hot parts of name matching, selectKernels() replaces the
+scalar versions with the best ones the CPU supports */
+static bool (*containsKernel)(const char* str, const NamePattern* name) = containsScalar;
+static bool (*containsFoldedKernel)(const char* str, const NamePattern* name) = containsFoldedScalar;
+static bool (*foldedEqualsKernel)(const char* str, const char* lower, size_t length) = foldedEqualsScalar;
+
+int main(int argc, char* argv[]) {
+    selectKernels();
+
+    char* path = (char*)allocateMemory(sizeof(char) * MAXPATHLENGTH);
+    Program* program = parseParams(argc, argv, path);
+
+    char* baseBuff = strdup(path);
+    Entry start = {
+        .dirFd = AT_FDCWD,
+        .name = path,
+        .baseName = basename(baseBuff),
+        .dirLength = STARTPATH,
+        .depth = 0,
+        .type = 0,
+        .hasInfo = false,
+        .pruned = false
+    };
+
+    if(isatty(STDOUT_FILENO)) {
+        options.lineBuffered = true;
+    }
+
+    if(options.maxOpenDirs == 0) {
+        options.maxOpenDirs = defaultOpenDirs();
+    }
+
+    // Writes what is buffered if a fatal error ends the program early
+    atexit(flushOutput);
+
+    // A missing start path is reported before any test could match or print it
+    entryInfo(&start);
+
+    if(options.threads > 1) {
+        runParallel(&start, program);
+    } else {
+        doEntry(&start, program);
+        walk(NULL, program);
+        closeUring();
+        mergeStats();
+    }
+
+    flushOutput();
+
+    if(options.printStats) {
+        printStats();
+    }
+
+    return 0;
+}
+
+/* Checks argc and argv for used parameters and compiles them into a program.
+The grammar, from lowest to highest precedence:
+expression = and { (-o | -or) and }
+and        = unary { [-a | -and] unary }
+unary      = (! | -not) unary | ( expression ) | primary */
+Program* parseParams(int argc, char* argv[], char* path) {
+    Parser parser = {
+        .argc = argc,
+        .argv = argv,
+        .pos = 1,
+        .hasAction = false,
+        .pathTests = 0
+    };
+
+    strncpy(path, ".", MAXPATHLENGTH);
+
+    if(argc > 1 && !stringStartsWith("-", argv[1]) && !startsOperand(argv[1])) {
+        strncpy(path, argv[1], MAXPATHLENGTH);
+        parser.pos++;
+    }
+
+    ExprNode* expr = NULL;
+
+    if(parser.pos < argc) {
+        expr = parseOr(&parser);
+
+        if(parser.pos < argc) {
+            fprintf(stderr, "%s is not a valid command.\n", argv[parser.pos]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(parser.hasAction == false) {
+        ExprNode* print = createPrimary(OP_PRINT);
+        expr = expr == NULL ? print : createNode(EXPR_AND, expr, print);
+    }
+
+    Program* program = (Program*)allocateMemory(sizeof(Program));
+    program->code = NULL;
+    program->length = 0;
+    program->capacity = 0;
+    program->pathTests = parser.pathTests;
+
+    compileExpression(program, optimizeExpression(expr));
+
+    options.fileInfoNeed = planFileInfo(program);
+    options.statxMask = planStatxMask(program);
+    return program;
+}
+
+// Parses operands joined by -o
+ExprNode* parseOr(Parser* parser) {
+    ExprNode* left = parseAnd(parser);
+
+    while(parser->pos < parser->argc) {
+        const char* arg = parser->argv[parser->pos];
+
+        if(strcmp(arg, "-o") != 0 && strcmp(arg, "-or") != 0) {
+            break;
+        }
+        parser->pos++;
+        left = createNode(EXPR_OR, left, parseAnd(parser));
+    }
+    return left;
+}
+
+// Parses operands joined by -a or written next to each other
+ExprNode* parseAnd(Parser* parser) {
+    ExprNode* left = parseUnary(parser);
+
+    while(parser->pos < parser->argc) {
+        const char* arg = parser->argv[parser->pos];
+
+        if(strcmp(arg, "-a") == 0 || strcmp(arg, "-and") == 0) {
+            parser->pos++;
+        } else if(!startsOperand(arg) && !stringStartsWith("-", arg)) {
+            break;
+        } else if(strcmp(arg, "-o") == 0 || strcmp(arg, "-or") == 0) {
+            break;
+        }
+        left = createNode(EXPR_AND, left, parseUnary(parser));
+    }
+    return left;
+}
+
+// Parses negations and parenthesized expressions
+ExprNode* parseUnary(Parser* parser) {
+    const char* arg = nextArgument(parser);
+
+    if(strcmp(arg, "!") == 0 || strcmp(arg, "-not") == 0) {
+        parser->pos++;
+        return createNode(EXPR_NOT, parseUnary(parser), NULL);
+    }
+
+    if(strcmp(arg, "(") == 0) {
+        parser->pos++;
+        ExprNode* expr = parseOr(parser);
+
+        if(parser->pos >= parser->argc || strcmp(parser->argv[parser->pos], ")") != 0) {
+            fprintf(stderr, "Missing closing parenthesis.\n");
+            exit(EXIT_FAILURE);
+        }
+        parser->pos++;
+        return expr;
+    }
+
+    return parsePrimary(parser);
+}
+
+// Parses a single test, action or option
+ExprNode* parsePrimary(Parser* parser) {
+    int argc = parser->argc;
+    char** argv = parser->argv;
+    int i = parser->pos;
+    ExprNode* node = NULL;
+
+    if(strcmp("-user", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+        node = createPrimary(OP_USER);
+        node->primary.arg.uid = resolveUser(argv[i+1]);
+        i++;
+    } else if(strcmp("-name", argv[i]) == 0 || strcmp("-iname", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+        node = createPrimary(OP_NAME);
+        node->primary.arg.name = compilePattern(argv[i+1], argv[i][1] == 'i');
+        i++;
+    } else if(strcmp("-path", argv[i]) == 0 || strcmp("-ipath", argv[i]) == 0 ||
+              strcmp("-wholename", argv[i]) == 0 || strcmp("-iwholename", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+        node = createPrimary(OP_PATH);
+        node->primary.arg.path.pattern = compilePattern(argv[i+1], argv[i][1] == 'i');
+        node->primary.arg.path.slot = parser->pathTests++;
+        i++;
+    } else if(strcmp("-regex", argv[i]) == 0 || strcmp("-iregex", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+        RegexTest* regex = compileRegex(argv[i+1], argv[i][1] == 'i');
+
+        regex->slot = parser->pathTests++;
+        node = createPrimary(OP_REGEX);
+        node->primary.arg.regex = regex;
+        i++;
+    } else if(strcmp("-type", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        if (!typeExists(argv[i+1])) {
+            fprintf(stderr, "Type does not exist.\n");
+            exit(1);
+        }
+
+        node = createPrimary(OP_TYPE);
+        node->primary.arg.fileType = decodeType(argv[i+1][0]);
+        i++;
+    } else if(strcmp("-dirbuf", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        if(!parseSize(argv[i+1], &options.dirBufferSize) || options.dirBufferSize < sizeof(LinuxDirent64) + 256) {
+            fprintf(stderr, "Invalid buffer size %s.\n", argv[i+1]);
+            exit(EXIT_FAILURE);
+        }
+        node = createPrimary(OP_TRUE);
+        i++;
+    } else if(strcmp("-stats", argv[i]) == 0) {
+        options.printStats = true;
+        node = createPrimary(OP_TRUE);
+    } else if(strcmp("-linebuffered", argv[i]) == 0) {
+        options.lineBuffered = true;
+        node = createPrimary(OP_TRUE);
+    } else if(strcmp("-ordered", argv[i]) == 0) {
+        options.ordered = true;
+        node = createPrimary(OP_TRUE);
+    } else if(strcmp("-uring", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        long depth = isNumeric(argv[i+1]) && strlen(argv[i+1]) < 6 ? strtol(argv[i+1], NULL, 10) : -1;
+
+        if(depth < 0 || depth > MAXURINGDEPTH) {
+            fprintf(stderr, "Queue depth must be between 0 and %d.\n", MAXURINGDEPTH);
+            exit(EXIT_FAILURE);
+        }
+        options.uringDepth = (unsigned int)depth;
+        node = createPrimary(OP_TRUE);
+        i++;
+    } else if(strcmp("-maxdepth", argv[i]) == 0 || strcmp("-mindepth", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        if(!isNumeric(argv[i+1]) || argv[i+1][0] == '\0' || strlen(argv[i+1]) > 9) {
+            fprintf(stderr, "Invalid depth %s.\n", argv[i+1]);
+            exit(EXIT_FAILURE);
+        }
+        size_t depth = (size_t)strtol(argv[i+1], NULL, 10);
+
+        if(argv[i][2] == 'a') {
+            options.maxDepth = depth;
+        } else {
+            options.minDepth = depth;
+        }
+        node = createPrimary(OP_TRUE);
+        i++;
+    } else if(strcmp("-maxfds", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        long maxFds = isNumeric(argv[i+1]) && strlen(argv[i+1]) < 10 ? strtol(argv[i+1], NULL, 10) : 0;
+
+        if(maxFds < MINOPENDIRS) {
+            fprintf(stderr, "Number of open directories must be at least %d.\n", MINOPENDIRS);
+            exit(EXIT_FAILURE);
+        }
+        options.maxOpenDirs = (unsigned long)maxFds;
+        node = createPrimary(OP_TRUE);
+        i++;
+    } else if(strcmp("-threads", argv[i]) == 0) {
+        verifyArgument(argc, argv, i);
+
+        long threads = isNumeric(argv[i+1]) && strlen(argv[i+1]) < 5 ? strtol(argv[i+1], NULL, 10) : 0;
+
+        if(threads < 1 || threads > MAXTHREADS) {
+            fprintf(stderr, "Number of threads must be between 1 and %d.\n", MAXTHREADS);
+            exit(EXIT_FAILURE);
+        }
+        options.threads = (unsigned int)threads;
+        node = createPrimary(OP_TRUE);
+        i++;
+    } else if(strcmp("-print", argv[i]) == 0) {
+        node = createPrimary(OP_PRINT);
+        parser->hasAction = true;
+    } else if(strcmp("-ls", argv[i]) == 0) {
+        node = createPrimary(OP_LS);
+        parser->hasAction = true;
+    } else if(strcmp("-prune", argv[i]) == 0) {
+        // Like in find, -prune does not replace the default -print
+        node = createPrimary(OP_PRUNE);
+    } else {
+        fprintf(stderr, "%s is not a valid command.\n", argv[i]);
+        exit(EXIT_FAILURE);
+    }
+
+    parser->pos = i + 1;
+    return node;
+}
+
+// Checks if an argument is an operator that can start an operand
+bool startsOperand(const char* arg) {
+    return strcmp(arg, "(") == 0 || strcmp(arg, "!") == 0;
+}
+
+// Returns the argument at the current position, exits if the expression ended early
+const char* nextArgument(Parser* parser) {
+    if(parser->pos >= parser->argc) {
+        fprintf(stderr, "Expected an expression after %s.\n", parser->argv[parser->pos - 1]);
+        exit(EXIT_FAILURE);
+    }
+    return parser->argv[parser->pos];
+}
+
+// Creates a leaf of the expression tree
+ExprNode* createPrimary(Opcode op) {
+    ExprNode* node = createNode(EXPR_PRIMARY, NULL, NULL);
+    node->primary.op = op;
+    return node;
+}
+
+// Creates a node of the expression tree
+ExprNode* createNode(ExprKind kind, ExprNode* left, ExprNode* right) {
+    ExprNode* node = (ExprNode*)allocateMemory(sizeof(ExprNode));
+
+    memset(node, 0, sizeof(ExprNode));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+// Collects the operands of directly nested nodes of the same kind, eg.: a -o (b -o c) -> a, b, c
+void collectOperands(ExprNode* node, ExprKind kind, ExprNode*** operands, size_t* count, size_t* capacity) {
+    if(node->kind == kind) {
+        collectOperands(node->left, kind, operands, count, capacity);
+        collectOperands(node->right, kind, operands, count, capacity);
+        return;
+    }
+
+    if(*count == *capacity) {
+        *capacity = *capacity == 0 ? 8 : *capacity * 2;
+        *operands = (ExprNode**)realloc(*operands, sizeof(ExprNode*) * *capacity);
+
+        if(*operands == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*operands)[(*count)++] = node;
+}
+
+/* Orders operands of -a by cost per probability of being false and operands
+of -o by cost per probability of being true, so the operand most likely to
+end the evaluation cheaply goes first */
+double operandRank(const ExprNode* node, ExprKind kind) {
+    double decisive = kind == EXPR_AND ? 1.0 - node->probability : node->probability;
+
+    if(decisive <= 0.0) {
+        return node->cost * 1e9 + 1e9;
+    }
+    return node->cost / decisive;
+}
+
+/* Replaces the -name operands of every run of -o operands without side effects
+by a single OP_NAME_SET, where the run has more than one of them. The order
+of tests without side effects does not change the result. */
+size_t mergeNamePatterns(ExprNode** operands, size_t count) {
+    const NamePattern** patterns = (const NamePattern**)allocateMemory(sizeof(NamePattern*) * count);
+    size_t kept = 0;
+    size_t start = 0;
+
+    while(start < count) {
+        size_t end = start;
+        size_t names = 0;
+        double missed = 1.0;    // probability that none of the names matches
+
+        for(; end < count && !operands[end]->sideEffects; end++) {
+            if(operands[end]->kind == EXPR_PRIMARY && operands[end]->primary.op == OP_NAME) {
+                patterns[names++] = &operands[end]->primary.arg.name;
+                missed *= 1.0 - operands[end]->probability;
+            }
+        }
+
+        if(names < 2) {
+            while(start < end) {
+                operands[kept++] = operands[start++];
+            }
+        } else {
+            ExprNode* merged = createPrimary(OP_NAME_SET);
+            NameSet* set = createNameSet(patterns, names);
+
+            merged->primary.arg.names = set;
+            merged->cost = 1.0 + 2.0 * (double)set->otherCount;
+            merged->probability = 1.0 - missed;
+
+            for(size_t i = start; i < end; i++) {
+                if(operands[i]->kind != EXPR_PRIMARY || operands[i]->primary.op != OP_NAME) {
+                    operands[kept++] = operands[i];
+                }
+            }
+            operands[kept++] = merged;
+        }
+
+        if(end < count) {
+            operands[kept++] = operands[end++];
+        }
+        start = end;
+    }
+
+    free(patterns);
+    return kept;
+}
+
+/* Estimates cost and probability of every node and reorders the operands of
+-a and -o. Operands containing actions keep their position and are never
+crossed, so actions run in the order and under the conditions they were given. */
+ExprNode* optimizeExpression(ExprNode* node) {
+    if(node->kind == EXPR_PRIMARY) {
+        estimatePrimary(node);
+        return node;
+    }
+
+    if(node->kind == EXPR_NOT) {
+        node->left = optimizeExpression(node->left);
+        node->cost = node->left->cost;
+        node->probability = 1.0 - node->left->probability;
+        node->sideEffects = node->left->sideEffects;
+        return node;
+    }
+
+    ExprKind kind = node->kind;
+    ExprNode** operands = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    collectOperands(node, kind, &operands, &count, &capacity);
+
+    size_t kept = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        ExprNode* operand = optimizeExpression(operands[i]);
+
+        // Options parse to "true", which does not change the result of -a
+        if(kind == EXPR_AND && operand->kind == EXPR_PRIMARY && operand->primary.op == OP_TRUE && count > 1) {
+            continue;
+        }
+        operands[kept++] = operand;
+    }
+
+    if(kept == 0) {
+        free(operands);
+        return createPrimary(OP_TRUE);
+    }
+
+    if(kind == EXPR_OR) {
+        kept = mergeNamePatterns(operands, kept);
+    }
+
+    // Stable insertion sort within every run of operands without side effects
+    for(size_t i = 1; i < kept; i++) {
+        ExprNode* operand = operands[i];
+        size_t j = i;
+
+        if(operand->sideEffects) {
+            continue;
+        }
+        while(j > 0 && !operands[j - 1]->sideEffects && operandRank(operands[j - 1], kind) > operandRank(operand, kind)) {
+            operands[j] = operands[j - 1];
+            j--;
+        }
+        operands[j] = operand;
+    }
+
+    ExprNode* result = operands[0];
+
+    for(size_t i = 1; i < kept; i++) {
+        ExprNode* right = operands[i];
+        ExprNode* joined = createNode(kind, result, right);
+
+        if(kind == EXPR_AND) {
+            joined->cost = result->cost + result->probability * right->cost;
+            joined->probability = result->probability * right->probability;
+        } else {
+            joined->cost = result->cost + (1.0 - result->probability) * right->cost;
+            joined->probability = 1.0 - (1.0 - result->probability) * (1.0 - right->probability);
+        }
+        joined->sideEffects = result->sideEffects || right->sideEffects;
+        result = joined;
+    }
+
+    free(operands);
+    return result;
+}
+
+/* Estimates cost and probability of a test or action. Costs are relative:
+name tests work on memory, type tests mostly on d_type and everything else needs stat. */
+void estimatePrimary(ExprNode* node) {
+    switch(node->primary.op) {
+        case OP_NAME: {
+            MatchKind kind = node->primary.arg.name.kind;
+            bool literal = kind == MATCH_LITERAL || kind == MATCH_FOLDED_LITERAL;
+
+            node->cost = literal ? 0.5 : kind == MATCH_FNMATCH || kind == MATCH_FOLDED_FNMATCH ? 2.0 : 1.0;
+            node->probability = literal ? 0.01 : 0.1;
+            break;
+        }
+        case OP_PATH:
+            node->cost = 1.5;
+            node->probability = 0.1;
+            break;
+        case OP_REGEX:
+            node->cost = node->primary.arg.regex->nfa != NULL ? 1.5 : 10.0;
+            node->probability = 0.1;
+            break;
+        case OP_TYPE:
+            node->cost = 2.0;
+            node->probability = node->primary.arg.fileType == S_IFREG ? 0.8 :
+                                node->primary.arg.fileType == S_IFDIR ? 0.15 : 0.01;
+            break;
+        case OP_USER:
+            node->cost = 20.0;
+            node->probability = 0.5;
+            break;
+        case OP_PRINT:
+            node->cost = 10.0;
+            node->probability = 1.0;
+            node->sideEffects = true;
+            break;
+        case OP_LS:
+            node->cost = 40.0;
+            node->probability = 1.0;
+            node->sideEffects = true;
+            break;
+        case OP_PRUNE:
+            node->cost = 0.0;
+            node->probability = 1.0;
+            node->sideEffects = true;
+            break;
+        default:
+            node->cost = 0.0;
+            node->probability = 1.0;
+            break;
+    }
+}
+
+// Compiles an expression tree into instructions, -a and -o become conditional jumps
+void compileExpression(Program* program, const ExprNode* node) {
+    switch(node->kind) {
+        case EXPR_PRIMARY:
+            *emitInstruction(program, node->primary.op) = node->primary;
+            break;
+        case EXPR_NOT:
+            compileExpression(program, node->left);
+            emitInstruction(program, OP_NOT);
+            break;
+        case EXPR_AND:
+        case EXPR_OR: {
+            compileExpression(program, node->left);
+
+            size_t jump = program->length;
+            emitInstruction(program, node->kind == EXPR_AND ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE);
+            compileExpression(program, node->right);
+            program->code[jump].arg.target = program->length;
+            break;
+        }
+    }
+}
+
+// Returns the statx fields an instruction reads
+unsigned int instructionStatxMask(const Instruction* instruction) {
+    switch(instruction->op) {
+        case OP_TYPE:
+            return STATX_TYPE;
+        case OP_USER:
+            return STATX_UID;
+        case OP_LS:
+            return STATX_TYPE | STATX_MODE | STATX_INO | STATX_BLOCKS | STATX_NLINK |
+                   STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+        default:
+            return 0;
+    }
+}
+
+/* Determines the statx fields the program needs. The type is always requested
+to decide whether to descend. The mask covers all instructions, so a single
+statx per entry answers every test no matter which one asks first. */
+unsigned int planStatxMask(const Program* program) {
+    unsigned int mask = STATX_TYPE;
+
+    for(size_t i = 0; i < program->length; i++) {
+        mask |= instructionStatxMask(&program->code[i]);
+    }
+    return mask;
+}
+
+// Appends an instruction to a program and returns it so its operand can be filled
+Instruction* emitInstruction(Program* program, Opcode op) {
+    if(program->length == program->capacity) {
+        program->capacity = program->capacity == 0 ? 8 : program->capacity * 2;
+        program->code = (Instruction*)realloc(program->code, sizeof(Instruction) * program->capacity);
+
+        if(program->code == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Instruction* instruction = &program->code[program->length++];
+    instruction->op = op;
+    return instruction;
+}
+
+// Checks if an argument that needs a variable has one
+void verifyArgument(int argc, char* argv[], int index) {
+    if((index + 1) >= argc) {
+        fprintf(stderr, "No argument provided for %s.\n", argv[index]);
+        exit(1);
+    }
+}
+
+// Checks if a user exists in user database
+bool userExists(const char* username, unsigned int* userId) {
+    struct passwd* user = getpwnam(username);
+
+    if(user == NULL) {
+        return false;
+    }
+    *userId = user->pw_uid;
+    return true;
+}
+
+// Checks if a userID exists in user database
+bool userIdExists(unsigned int userId) {
+    struct passwd* user = getpwuid(userId);
+
+    if(user == NULL) {
+        return false;
+    }
+    return true;
+}
+
+// Checks if a group exists in the group database
+bool groupExists(const char* groupName) {
+    struct group* grp = getgrnam(groupName);
+
+    if(grp == NULL) {
+        return false;
+    }
+    return true;
+}
+
+// Checks if a groupID exists in the group database
+bool groupIdExists(unsigned int groupId) {
+    struct group* grp = getgrgid(groupId);
+
+    if(grp == NULL) {
+        return false;
+    }
+    return true;
+}
+
+// Checks if a given type is allowed
+bool typeExists(const char* type) {
+    static char allowedTypes[7] = {'b', 'c', 'd', 'p', 'f', 'l', 's'};
+
+    for(unsigned int i = 0; i < sizeof(allowedTypes); i++) {
+        if(type[0] == allowedTypes[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns what an instruction needs to know about a file to be evaluated
+FileInfoNeed instructionNeeds(const Instruction* instruction) {
+    switch(instruction->op) {
+        case OP_TYPE:
+            return NEED_TYPE;
+        case OP_USER:
+        case OP_LS:
+            return NEED_STAT;
+        default:
+            return NEED_NOTHING;
+    }
+}
+
+// Determines the most expensive file information any instruction of a program needs
+FileInfoNeed planFileInfo(const Program* program) {
+    FileInfoNeed need = NEED_NOTHING;
+
+    for(size_t i = 0; i < program->length; i++) {
+        FileInfoNeed instructionNeed = instructionNeeds(&program->code[i]);
+
+        if(instructionNeed > need) {
+            need = instructionNeed;
+        }
+    }
+    return need;
+}
+
+/* Called for every entry to be tested. The file information is fetched
+lazily by the first parameter that needs it and shared by all others, so
+every entry is stat'ed at most once. A directory is queued for the workers
+with -threads, otherwise it is put on the stack of the walker. */
+void doEntry(Entry* entry, const Program* program) {
+    stats.entries++;
+
+    if(entry->depth >= options.minDepth) {
+        runProgram(program, entry);
+    }
+
+    /* A pruned directory is never opened, its whole subtree is skipped. At
+    -maxdepth not even the type is needed, which saves the stat of entries
+    without d_type. */
+    if(entry->depth < options.maxDepth && !entry->pruned && S_ISDIR(entryType(entry))) {
+        if(currentWorker != NULL) {
+            OutputNode* output = NULL;
+
+            if(currentOutput != NULL) {
+                output = createOutputNode(currentWorker);
+                publishChunk(currentOutput);
+                appendOutputItem(currentOutput, NULL, 0, output);
+            }
+            const char* path = entryPath(entry);
+
+            pushTask(currentWorker, path, walkPath.length, entry->depth, output);
+        } else {
+            entryPath(entry);
+            pushDirectory(entry->dirFd, entry->name, walkPath.length, entry->depth);
+        }
+    }
+}
+
+// Runs the instructions of a program on an entry and returns the result of the expression
+bool runProgram(const Program* program, Entry* entry) {
+    const Instruction* code = program->code;
+    size_t pc = 0;
+    bool result = true;
+
+    while(pc < program->length) {
+        const Instruction* instruction = &code[pc++];
+
+        switch(instruction->op) {
+            case OP_PRINT:
+                printPath(entryPath(entry));
+                result = true;
+                break;
+            case OP_LS:
+                printLs(entryPath(entry), entryInfo(entry));
+                result = true;
+                break;
+            case OP_PRUNE:
+                entry->pruned = true;
+                result = true;
+                break;
+            case OP_USER:
+                result = entryInfo(entry)->stx_uid == instruction->arg.uid;
+                break;
+            case OP_TYPE:
+                result = entryType(entry) == instruction->arg.fileType;
+                break;
+            case OP_NAME:
+                result = compPath(&instruction->arg.name, entry->baseName);
+                break;
+            case OP_NAME_SET:
+                result = matchNameSet(instruction->arg.names, entry->baseName);
+                break;
+            case OP_PATH:
+                result = matchPath(program, &instruction->arg.path, entry);
+                break;
+            case OP_REGEX:
+                result = matchRegex(program, instruction->arg.regex, entry);
+                break;
+            case OP_TRUE:
+                result = true;
+                break;
+            case OP_NOT:
+                result = !result;
+                break;
+            case OP_JUMP_IF_FALSE:
+                if(!result) {
+                    pc = instruction->arg.target;
+                }
+                break;
+            case OP_JUMP_IF_TRUE:
+                if(result) {
+                    pc = instruction->arg.target;
+                }
+                break;
+        }
+    }
+    return result;
+}
+
+/* Returns the file information of an entry, calling statx on first use. Only
+the fields in options.statxMask are requested, and cached attributes are
+accepted without syncing with a network filesystem's server. On failure the
+information is cleared. */
+const FileInfo* entryInfo(Entry* entry) {
+    if(entry->hasInfo) {
+        return &entry->info;
+    }
+
+    stats.statCalls++;
+    errno = 0;
+
+    if(statx(entry->dirFd, entry->name, AT_STATX_DONT_SYNC, options.statxMask, &entry->info) != 0) {
+        switch (errno) {
+            case EACCES:
+                printMessage("stat(\"%s\") failed.\n", entryPath(entry));
+                break;
+            default:
+                error(EXIT_FAILURE, errno, "stat(\"%s\") failed.\n", entryPath(entry));
+                break;
+        }
+        memset(&entry->info, 0, sizeof(FileInfo));
+    }
+
+    entry->hasInfo = true;
+    entry->type = entry->info.stx_mode & S_IFMT;
+    return &entry->info;
+}
+
+// Returns the file type bits of an entry, only calling stat if d_type did not provide them
+mode_t entryType(Entry* entry) {
+    if(entry->type == 0 && !entry->hasInfo) {
+        entryInfo(entry);
+    }
+    return entry->type;
+}
+
+/* Tests the entries of the directories on the stack of the walker until it is
+back at bottom. Directories found on the way are pushed and read first, which
+walks the tree depth first like a recursive walk would. */
+void walk(const DirFrame* bottom, const Program* program) {
+    while(walkStack != bottom) {
+        Entry* entry = nextEntry(walkStack);
+
+        if(entry == NULL) {
+            popDirectory();
+        } else {
+            doEntry(entry, program);
+        }
+    }
+}
+
+/* Opens a directory and puts it on the stack of the walker, parentFd is the
+directory containing name. The path of the directory is the first pathLength
+characters of walkPath. Returns false if it could not be opened. */
+bool pushDirectory(int parentFd, const char* name, size_t pathLength, size_t depth) {
+    errno = 0;
+    int fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(fd < 0) {
+        switch(errno) {
+            case EACCES:
+                printMessage("opendir(%s) failed.\n", truncatePath(pathLength));
+                break;
+            default: error(EXIT_FAILURE, errno, "opendir(%s) failed.\n", truncatePath(pathLength));
+        }
+        return false;
+    }
+
+    stats.directories++;
+
+    DirFrame* frame = freeFrames;
+
+    if(frame != NULL) {
+        freeFrames = frame->parent;
+    } else {
+        frame = (DirFrame*)allocateMemory(sizeof(DirFrame));
+        frame->pathStates = NULL;
+    }
+
+    openDirReader(&frame->reader, fd);
+    frame->pathLength = pathLength;
+    frame->depth = depth;
+    frame->batch = NULL;
+    frame->batchCount = 0;
+    frame->batchNext = 0;
+    frame->pathStatesReady = false;
+    frame->parentPath = true;
+
+    if(options.uringDepth > 0 && getUring() != NULL) {
+        EntryBatch* batch = freeEntryBatches;
+
+        if(batch != NULL) {
+            freeEntryBatches = batch->next;
+        } else {
+            batch = (EntryBatch*)allocateMemory(sizeof(EntryBatch));
+            batch->entries = (Entry*)allocateMemory(sizeof(Entry) * options.uringDepth);
+        }
+        frame->batch = batch;
+    }
+
+    frame->parent = walkStack;
+    frame->child = NULL;
+    if(walkStack != NULL) {
+        walkStack->child = frame;
+    }
+    walkStack = frame;
+
+    noteOpened(frame);
+    return true;
+}
+
+/* Closes the innermost directory of the walker. If its parent was closed to
+stay within the budget, the parent is opened again through "..", which is
+cheap at any depth. Through a symbolic link ".." is a different directory,
+then the parent is opened again by path once it is read. */
+void popDirectory(void) {
+    DirFrame* frame = walkStack;
+    DirFrame* parent = frame->parent;
+    int parentFd = -1;
+
+    if(parent != NULL && parent->reader.fd < 0 && frame->reader.fd >= 0) {
+        parentFd = openat(frame->reader.fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    walkStack = parent;
+
+    if(frame->reader.fd >= 0) {
+        openFrames--;
+    }
+    if(oldestOpen == frame) {
+        oldestOpen = NULL;
+    }
+    closeDirReader(&frame->reader);
+
+    if(frame->batch != NULL) {
+        frame->batch->next = freeEntryBatches;
+        freeEntryBatches = frame->batch;
+    }
+
+    frame->parent = freeFrames;
+    freeFrames = frame;
+
+    if(parentFd >= 0 && !restoreDirectory(parent, parentFd)) {
+        close(parentFd);
+    }
+}
+
+// Counts a directory that was opened and closes the shallowest ones while there are too many
+void noteOpened(DirFrame* frame) {
+    openFrames++;
+
+    if(oldestOpen == NULL) {
+        oldestOpen = frame;
+    }
+
+    // The innermost directory is never closed, its entries are being read
+    while(openFrames > options.maxOpenDirs && oldestOpen != NULL && oldestOpen != walkStack) {
+        evictDirectory(oldestOpen);
+    }
+}
+
+// Closes a directory early, saving where to continue reading it
+void evictDirectory(DirFrame* frame) {
+    struct stat dirStat;
+
+    if(fstat(frame->reader.fd, &dirStat) != 0) {
+        error(EXIT_FAILURE, errno, "fstat(%s) failed.\n", truncatePath(frame->pathLength));
+    }
+
+    frame->dev = dirStat.st_dev;
+    frame->ino = dirStat.st_ino;
+    // The records already read stay in the buffer, getdents continues after them
+    frame->offset = lseek(frame->reader.fd, 0, SEEK_CUR);
+
+    close(frame->reader.fd);
+    frame->reader.fd = -1;
+    openFrames--;
+    oldestOpen = frame->child;
+}
+
+/* Opens a directory that was closed early by path, relative to the nearest
+ancestor that is still open. The path is still in walkPath, since the
+walker only returns to a directory once everything below it is done. */
+bool reopenDirectory(DirFrame* frame) {
+    DirFrame* ancestor = frame->parent;
+
+    while(ancestor != NULL && ancestor->reader.fd < 0) {
+        ancestor = ancestor->parent;
+    }
+
+    const char* path = truncatePath(frame->pathLength);
+    size_t offset = ancestor != NULL ? ancestor->pathLength + 1 : 0;
+    int fd = openPath(ancestor != NULL ? ancestor->reader.fd : AT_FDCWD, path + offset, frame->pathLength - offset);
+
+    if(fd < 0) {
+        error(0, errno, "opendir(%s) failed.\n", path);
+        return false;
+    }
+    if(!restoreDirectory(frame, fd)) {
+        error(0, 0, "%s was replaced during the traversal.\n", path);
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+/* Continues reading a directory that was closed early with a new descriptor.
+Fails if fd is not the same directory. */
+bool restoreDirectory(DirFrame* frame, int fd) {
+    struct stat dirStat;
+
+    if(fstat(fd, &dirStat) != 0 || dirStat.st_dev != frame->dev || dirStat.st_ino != frame->ino) {
+        return false;
+    }
+    if(!frame->reader.eof && lseek(fd, frame->offset, SEEK_SET) < 0) {
+        return false;
+    }
+
+    frame->reader.fd = fd;
+
+    // Entries that were read before are resolved relative to the new descriptor
+    if(frame->batch != NULL) {
+        for(size_t i = frame->batchNext; i < frame->batchCount; i++) {
+            frame->batch->entries[i].dirFd = fd;
+        }
+    }
+
+    stats.reopens++;
+    noteOpened(frame);
+    return true;
+}
+
+/* Opens a directory path relative to dirFd. A path longer than the kernel
+accepts is opened piece by piece. Returns -1 with errno set on failure. */
+int openPath(int dirFd, const char* path, size_t length) {
+    char piece[MAXPATHLENGTH];
+    int fd = dirFd;
+
+    while(true) {
+        size_t pieceLength = length;
+
+        if(pieceLength >= MAXPATHLENGTH) {
+            // Cut at the last '/' that fits, a name is never longer than NAME_MAX
+            pieceLength = MAXPATHLENGTH - 1;
+            while(pieceLength > 1 && path[pieceLength] != '/') {
+                pieceLength--;
+            }
+        }
+        memcpy(piece, path, pieceLength);
+        piece[pieceLength] = '\0';
+
+        int next = openat(fd, piece, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int openErrno = errno;
+
+        if(fd != dirFd) {
+            close(fd);
+        }
+        if(next < 0) {
+            errno = openErrno;
+            return -1;
+        }
+        fd = next;
+
+        if(pieceLength >= length) {
+            return fd;
+        }
+        while(pieceLength < length && path[pieceLength] == '/') {
+            pieceLength++;
+        }
+        path += pieceLength;
+        length -= pieceLength;
+    }
+}
+
+/* Splits the open file limit between the threads, keeping some descriptors
+for io_uring, output and the parents of directories with long paths */
+unsigned long defaultOpenDirs(void) {
+    struct rlimit limit;
+    unsigned long files = 1024;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        files = limit.rlim_cur == RLIM_INFINITY ? 1024 * 1024 : (unsigned long)limit.rlim_cur;
+    }
+
+    unsigned long perThread = files > FDRESERVE ? (files - FDRESERVE) / options.threads : 0;
+
+    return perThread > MINOPENDIRS ? perThread : MINOPENDIRS;
+}
+
+// Returns the next entry of a directory to be tested, NULL once all were read
+Entry* nextEntry(DirFrame* frame) {
+    if(frame->reader.fd < 0 && !reopenDirectory(frame)) {
+        return NULL;
+    }
+
+    if(frame->batch != NULL) {
+        if(frame->batchNext == frame->batchCount && !fillBatch(frame)) {
+            return NULL;
+        }
+        return &frame->batch->entries[frame->batchNext++];
+    }
+
+    LinuxDirent64* record;
+
+    while((record = readRecord(frame)) != NULL) {
+        if(!isDotEntry(record->d_name)) {
+            initEntry(&frame->entry, frame, record);
+            return &frame->entry;
+        }
+    }
+    return NULL;
+}
+
+// Returns the next record of a directory, reporting a failed read
+LinuxDirent64* readRecord(DirFrame* frame) {
+    LinuxDirent64* record = readDirEntry(&frame->reader);
+
+    if(record == NULL && errno != 0) {
+        error(0, errno, "getdents(%s) failed.\n", truncatePath(frame->pathLength));
+    }
+    return record;
+}
+
+// Prepares an entry for a record read from the directory of a frame
+void initEntry(Entry* entry, const DirFrame* frame, const LinuxDirent64* record) {
+    entry->dirFd = frame->reader.fd;
+    entry->name = record->d_name;
+    entry->baseName = record->d_name;
+    entry->dirLength = frame->pathLength;
+    entry->depth = frame->depth + 1;
+    // Symbolic links are followed, so their d_type says nothing about the target
+    entry->type = record->d_type == DT_LNK ? 0 : DTTOIF(record->d_type);
+    entry->hasInfo = false;
+    entry->pruned = false;
+}
+
+// Checks if a name is "." or ".."
+bool isDotEntry(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Reads the next batch of up to options.uringDepth entries of a directory.
+The file information of a whole batch is requested at once, so the latency of
+slow filesystems overlaps instead of adding up. A batch never spans two reads
+of the directory, since a read overwrites the records the entries point to.
+Returns false once all entries were read. */
+bool fillBatch(DirFrame* frame) {
+    EntryBatch* batch = frame->batch;
+    DirReader* reader = &frame->reader;
+    LinuxDirent64* record;
+    size_t count;
+
+    do {
+        count = 0;
+
+        while(count < options.uringDepth && (record = readRecord(frame)) != NULL) {
+            if(!isDotEntry(record->d_name)) {
+                initEntry(&batch->entries[count++], frame, record);
+            }
+            if(reader->pos >= reader->len) {
+                break;
+            }
+        }
+    } while(count == 0 && record != NULL);
+
+    if(count == 0) {
+        return false;
+    }
+
+    prefetchInfo(getUring(), batch->entries, count);
+    frame->batchCount = count;
+    frame->batchNext = 0;
+    return true;
+}
+
+// Checks if evaluating an entry will call stat, either for the program or to decide whether to descend
+bool needsPrefetch(const Entry* entry) {
+    bool tested = entry->depth >= options.minDepth;
+    bool typeNeeded = entry->depth < options.maxDepth || (tested && options.fileInfoNeed != NEED_NOTHING);
+
+    return (tested && options.fileInfoNeed == NEED_STAT) || (entry->type == 0 && typeNeeded);
+}
+
+/* Requests the file information of all entries that will need it with one
+submission and waits for the results. Entries whose request failed are left
+alone, entryInfo() stats them again and reports the error. */
+void prefetchInfo(Uring* ring, Entry* entries, size_t count) {
+    unsigned int tail = *ring->sqTail;
+    unsigned int submitted = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(!needsPrefetch(&entries[i])) {
+            continue;
+        }
+
+        unsigned int index = tail & *ring->sqMask;
+        struct io_uring_sqe* sqe = &ring->sqes[index];
+
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = entries[i].dirFd;
+        sqe->addr = (uint64_t)(uintptr_t)entries[i].name;
+        sqe->len = options.statxMask;
+        sqe->off = (uint64_t)(uintptr_t)&entries[i].info;
+        sqe->statx_flags = AT_STATX_DONT_SYNC;
+        sqe->user_data = i;
+
+        ring->sqArray[index] = index;
+        tail++;
+        submitted++;
+    }
+
+    if(submitted == 0) {
+        return;
+    }
+
+    __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+    stats.statCalls += submitted;
+
+    unsigned int toSubmit = submitted;
+    unsigned int completed = 0;
+
+    while(completed < submitted) {
+        stats.uringSubmits++;
+        long ret = syscall(__NR_io_uring_enter, ring->fd, toSubmit, submitted - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            error(EXIT_FAILURE, errno, "io_uring_enter() failed.\n");
+        }
+        toSubmit -= (unsigned int)ret < toSubmit ? (unsigned int)ret : toSubmit;
+
+        unsigned int head = *ring->cqHead;
+        unsigned int cqTail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+        for(; head != cqTail; head++) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+            Entry* entry = &entries[cqe->user_data];
+
+            if(cqe->res == 0) {
+                entry->hasInfo = true;
+                entry->type = entry->info.stx_mode & S_IFMT;
+            }
+            completed++;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+// Returns the ring of the calling thread, NULL if io_uring is not available
+Uring* getUring(void) {
+    if(threadUring != NULL || uringFailed) {
+        return threadUring;
+    }
+
+    Uring* ring = (Uring*)allocateMemory(sizeof(Uring));
+
+    if(!setupUring(ring, options.uringDepth)) {
+        // Kernels without io_uring or with io_uring disabled use the synchronous path
+        free(ring);
+        uringFailed = true;
+        return NULL;
+    }
+
+    threadUring = ring;
+    return ring;
+}
+
+// Sets up a ring and maps its queues
+bool setupUring(Uring* ring, unsigned int entries) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+    if(fd < 0) {
+        return false;
+    }
+
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cqRing = ring->sqRing;
+
+    if(ring->sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if(ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    char* sq = (char*)ring->sqRing;
+    char* cq = (char*)ring->cqRing;
+
+    ring->sqHead = (unsigned int*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned int*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+// Unmaps and closes the ring of the calling thread
+void closeUring(void) {
+    Uring* ring = threadUring;
+
+    if(ring == NULL) {
+        return;
+    }
+
+    munmap(ring->sqes, ring->sqesSize);
+    if(ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+    free(ring);
+    threadUring = NULL;
+}
+
+static __thread DirBuffer* freeDirBuffers = NULL;
+
+// Prepares reading a directory, taking a buffer from the free list
+void openDirReader(DirReader* reader, int fd) {
+    DirBuffer* buff = freeDirBuffers;
+
+    if(buff != NULL) {
+        freeDirBuffers = buff->next;
+    } else {
+        buff = (DirBuffer*)allocateMemory(sizeof(DirBuffer));
+        buff->size = options.dirBufferSize < DIRBUFMIN ? options.dirBufferSize : DIRBUFMIN;
+        buff->data = (char*)allocateMemory(buff->size);
+    }
+
+    reader->fd = fd;
+    reader->buff = buff;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->eof = false;
+}
+
+/* Returns the next record of a directory or NULL once all records were read.
+The record points into the read buffer and is only valid until the next call.
+On failure NULL is returned with errno set, errno is 0 at the end of the directory. */
+LinuxDirent64* readDirEntry(DirReader* reader) {
+    if(reader->pos >= reader->len) {
+        if(reader->eof) {
+            errno = 0;
+            return NULL;
+        }
+
+        DirBuffer* buff = reader->buff;
+
+        // The previous read filled the buffer, so this is a large directory
+        if(reader->len > buff->size / 2 && buff->size < options.dirBufferSize) {
+            size_t newSize = buff->size * 4 < options.dirBufferSize ? buff->size * 4 : options.dirBufferSize;
+            free(buff->data);
+            buff->data = (char*)allocateMemory(newSize);
+            buff->size = newSize;
+        }
+
+        stats.dirReads++;
+        long bytesRead = syscall(SYS_getdents64, reader->fd, buff->data, buff->size);
+
+        if(bytesRead <= 0) {
+            reader->eof = true;
+            reader->len = 0;
+            if(bytesRead == 0) {
+                errno = 0;
+            }
+            return NULL;
+        }
+
+        reader->pos = 0;
+        reader->len = (size_t)bytesRead;
+    }
+
+    LinuxDirent64* record = (LinuxDirent64*)(reader->buff->data + reader->pos);
+    reader->pos += record->d_reclen;
+
+    return record;
+}
+
+// Closes a directory and returns its buffer to the free list
+void closeDirReader(DirReader* reader) {
+    if(reader->fd >= 0) {
+        close(reader->fd);
+    }
+
+    reader->buff->next = freeDirBuffers;
+    freeDirBuffers = reader->buff;
+    reader->buff = NULL;
+}
+
+/* Traverses the tree with options.threads workers. The calling thread becomes
+the first worker, evaluates the start path and then helps with the queue. */
+void runParallel(Entry* start, const Program* program) {
+    pool.count = options.threads;
+    pool.workers = (Worker*)allocateMemory(sizeof(Worker) * pool.count);
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.queued, 0);
+    atomic_init(&pool.idle, 0);
+    pthread_mutex_init(&pool.idleLock, NULL);
+    pthread_cond_init(&pool.idleCond, NULL);
+
+    for(unsigned int i = 0; i < pool.count; i++) {
+        Worker* worker = &pool.workers[i];
+
+        worker->id = i;
+        worker->program = program;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.tasks = NULL;
+        worker->deque.head = 0;
+        worker->deque.count = 0;
+        worker->deque.capacity = 0;
+    }
+
+    OutputNode* rootOutput = NULL;
+
+    currentWorker = &pool.workers[0];
+
+    if(options.ordered) {
+        rootOutput = createOutputNode(currentWorker);
+        outputQueue.head = rootOutput;
+
+        int err = pthread_create(&outputQueue.emitter, NULL, runEmitter, rootOutput);
+
+        if(err != 0) {
+            error(EXIT_FAILURE, err, "pthread_create() failed.\n");
+        }
+    }
+
+    currentOutput = rootOutput;
+    doEntry(start, program);
+    currentOutput = NULL;
+
+    if(rootOutput != NULL) {
+        finishOutput(rootOutput);
+    }
+
+    for(unsigned int i = 1; i < pool.count; i++) {
+        int err = pthread_create(&pool.workers[i].thread, NULL, runWorker, &pool.workers[i]);
+
+        if(err != 0) {
+            error(EXIT_FAILURE, err, "pthread_create() failed.\n");
+        }
+    }
+
+    runWorker(&pool.workers[0]);
+
+    for(unsigned int i = 1; i < pool.count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    if(options.ordered) {
+        pthread_join(outputQueue.emitter, NULL);
+    }
+}
+
+// Runs tasks from the own deque, steals from others when it is empty and returns when all are done
+void* runWorker(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Task task;
+
+    currentWorker = worker;
+
+    while(true) {
+        if(popTask(worker, &task) || stealTask(worker, &task)) {
+            runTask(worker, &task);
+        } else if(!waitForTask()) {
+            break;
+        }
+    }
+
+    closeUring();
+    flushOutput();
+    mergeStats();
+
+    if(currentPathBlock != NULL) {
+        releasePathBlock(currentPathBlock);
+        currentPathBlock = NULL;
+    }
+    return NULL;
+}
+
+/* Reads the directory of a task. With -ordered it may run nested inside another
+task whose output is blocked, which still holds pointers into walkPath, so the
+nested task gets a path builder of its own. */
+void runTask(Worker* worker, Task* task) {
+    OutputNode* outerOutput = currentOutput;
+    PathBuilder outerPath = walkPath;
+
+    if(outerOutput != NULL) {
+        walkPath = (PathBuilder){ .data = NULL, .length = 0, .capacity = 0 };
+    }
+
+    currentOutput = task->output;
+    truncatePath(0);
+    appendPath(task->path, task->pathLength);
+
+    /* Nested tasks walk on top of the directories of the outer task. The
+    outer ones are left open, one of their entries is still being tested. */
+    DirFrame* bottom = walkStack;
+    DirFrame* outerOldest = oldestOpen;
+
+    oldestOpen = NULL;
+    const char* name = task->path;
+    int parentFd = AT_FDCWD;
+
+    /* The kernel rejects longer paths, the parent is opened piece by piece
+    instead. Queued tasks hold no descriptors, however many there are. */
+    if(task->pathLength >= MAXPATHLENGTH) {
+        name = strrchr(task->path, '/') + 1;
+        parentFd = openPath(AT_FDCWD, task->path, (size_t)(name - 1 - task->path));
+
+        if(parentFd < 0) {
+            switch(errno) {
+                case EACCES:
+                    printMessage("opendir(%s) failed.\n", truncatePath(task->pathLength));
+                    break;
+                default: error(EXIT_FAILURE, errno, "opendir(%s) failed.\n", truncatePath(task->pathLength));
+            }
+        }
+    }
+
+    bool opened = parentFd != -1 && pushDirectory(parentFd, name, task->pathLength, task->depth);
+
+    if(parentFd >= 0) {
+        close(parentFd);
+    }
+    if(opened) {
+        walkStack->parentPath = false;
+        walk(bottom, worker->program);
+    }
+    oldestOpen = outerOldest;
+
+    if(task->output != NULL) {
+        finishOutput(task->output);
+    }
+    currentOutput = outerOutput;
+    releasePathBlock(task->block);
+
+    if(outerOutput != NULL) {
+        free(walkPath.data);
+        walkPath = outerPath;
+    }
+
+    if(atomic_fetch_sub(&pool.pending, 1) == 1) {
+        // That was the last task, wake everyone up so they can finish
+        pthread_mutex_lock(&pool.idleLock);
+        pthread_cond_broadcast(&pool.idleCond);
+        pthread_mutex_unlock(&pool.idleLock);
+    }
+}
+
+// Queues a directory on the deque of a worker, path is copied until the directory was read
+void pushTask(Worker* worker, const char* path, size_t length, size_t depth, OutputNode* output) {
+    TaskDeque* deque = &worker->deque;
+    PathBlock* block;
+
+    path = storePath(path, length, &block);
+
+    atomic_fetch_add(&pool.pending, 1);
+    pthread_mutex_lock(&deque->lock);
+
+    if(deque->count == deque->capacity) {
+        size_t capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+        Task* tasks = (Task*)allocateMemory(sizeof(Task) * capacity);
+
+        for(size_t i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    Task* task = &deque->tasks[(deque->head + deque->count) % deque->capacity];
+    task->path = path;
+    task->pathLength = length;
+    task->block = block;
+    task->depth = depth;
+    task->output = output;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+    atomic_fetch_add(&pool.queued, 1);
+
+    if(atomic_load(&pool.idle) > 0) {
+        pthread_mutex_lock(&pool.idleLock);
+        pthread_cond_signal(&pool.idleCond);
+        pthread_mutex_unlock(&pool.idleLock);
+    }
+}
+
+// Takes the newest task from the own deque
+bool popTask(Worker* worker, Task* task) {
+    TaskDeque* deque = &worker->deque;
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if(deque->count > 0) {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        found = true;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+
+    if(found) {
+        atomic_fetch_sub(&pool.queued, 1);
+    }
+    return found;
+}
+
+// Takes the oldest task from the deque of another worker
+bool stealTask(Worker* thief, Task* task) {
+    if(atomic_load(&pool.queued) == 0) {
+        return false;
+    }
+
+    for(unsigned int i = 1; i < pool.count; i++) {
+        TaskDeque* deque = &pool.workers[(thief->id + i) % pool.count].deque;
+        bool found = false;
+
+        pthread_mutex_lock(&deque->lock);
+
+        if(deque->count > 0) {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+            deque->count--;
+            found = true;
+        }
+
+        pthread_mutex_unlock(&deque->lock);
+
+        if(found) {
+            atomic_fetch_sub(&pool.queued, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Copies a path into the current path block of the thread, starting a new block
+when it is full, and returns the copy. The block is returned through block and
+must be released once the copy is not needed anymore. */
+const char* storePath(const char* path, size_t length, PathBlock** block) {
+    PathBlock* current = currentPathBlock;
+
+    if(current == NULL || current->used + length + 1 > current->size) {
+        size_t size = length + 1 > PATHBLOCKSIZE ? length + 1 : PATHBLOCKSIZE;
+
+        if(current != NULL) {
+            releasePathBlock(current);
+        }
+        current = (PathBlock*)allocateMemory(sizeof(PathBlock) + size);
+        atomic_init(&current->refs, 1);
+        current->used = 0;
+        current->size = size;
+        currentPathBlock = current;
+    }
+
+    char* copy = current->data + current->used;
+
+    memcpy(copy, path, length);
+    copy[length] = '\0';
+    current->used += length + 1;
+    atomic_fetch_add(&current->refs, 1);
+
+    *block = current;
+    return copy;
+}
+
+// Drops one reference to a path block and frees it with the last one
+void releasePathBlock(PathBlock* block) {
+    if(atomic_fetch_sub(&block->refs, 1) == 1) {
+        free(block);
+    }
+}
+
+// Takes the task writing to output out of the deque of its owner, fails if somebody else took it already
+bool claimTask(Worker* owner, OutputNode* output, Task* task) {
+    TaskDeque* deque = &owner->deque;
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+
+    for(size_t i = 0; i < deque->count; i++) {
+        if(deque->tasks[(deque->head + i) % deque->capacity].output != output) {
+            continue;
+        }
+
+        *task = deque->tasks[(deque->head + i) % deque->capacity];
+
+        for(size_t j = i + 1; j < deque->count; j++) {
+            deque->tasks[(deque->head + j - 1) % deque->capacity] = deque->tasks[(deque->head + j) % deque->capacity];
+        }
+        deque->count--;
+        found = true;
+        break;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+
+    if(found) {
+        atomic_fetch_sub(&pool.queued, 1);
+    }
+    return found;
+}
+
+// Sleeps until a task was queued, returns false once all tasks are done
+bool waitForTask(void) {
+    bool more;
+
+    pthread_mutex_lock(&pool.idleLock);
+    atomic_fetch_add(&pool.idle, 1);
+
+    while(atomic_load(&pool.queued) == 0 && atomic_load(&pool.pending) > 0) {
+        pthread_cond_wait(&pool.idleCond, &pool.idleLock);
+    }
+
+    atomic_fetch_sub(&pool.idle, 1);
+    more = atomic_load(&pool.pending) > 0;
+    pthread_mutex_unlock(&pool.idleLock);
+
+    return more;
+}
+
+// Creates the output node of a directory task that will be queued on the deque of owner
+OutputNode* createOutputNode(Worker* owner) {
+    OutputNode* node = (OutputNode*)allocateMemory(sizeof(OutputNode));
+
+    node->first = NULL;
+    node->last = NULL;
+    node->done = false;
+    node->owner = owner;
+    node->chunk = NULL;
+    node->chunkLength = 0;
+    return node;
+}
+
+// Appends a chunk of text or a link to a subdirectory to a node and wakes the emitter
+void appendOutputItem(OutputNode* node, char* data, size_t length, OutputNode* child) {
+    OutputItem* item = (OutputItem*)allocateMemory(sizeof(OutputItem));
+
+    item->data = data;
+    item->length = length;
+    item->child = child;
+    item->next = NULL;
+
+    pthread_mutex_lock(&outputQueue.lock);
+
+    if(node->last == NULL) {
+        node->first = item;
+    } else {
+        node->last->next = item;
+    }
+    node->last = item;
+    outputQueue.bufferedBytes += length;
+
+    if(node == outputQueue.head) {
+        pthread_cond_signal(&outputQueue.itemAdded);
+    }
+    pthread_mutex_unlock(&outputQueue.lock);
+}
+
+/* Hands the text a worker collected for a node to the emitter. Blocks while
+too much text is buffered, unless the emitter is waiting for this node. */
+void publishChunk(OutputNode* node) {
+    if(node->chunkLength == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&outputQueue.lock);
+
+    while(outputQueue.bufferedBytes > ORDEREDBUFFERLIMIT && outputQueue.head != node) {
+        OutputNode* head = outputQueue.head;
+        Worker* owner = head->owner;
+        Task task;
+
+        pthread_mutex_unlock(&outputQueue.lock);
+
+        // Nobody started the directory the emitter is waiting for, so run it here
+        if(claimTask(owner, head, &task)) {
+            runTask(currentWorker, &task);
+            pthread_mutex_lock(&outputQueue.lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&outputQueue.lock);
+
+        if(outputQueue.bufferedBytes > ORDEREDBUFFERLIMIT && outputQueue.head == head) {
+            pthread_cond_wait(&outputQueue.spaceFreed, &outputQueue.lock);
+        }
+    }
+
+    pthread_mutex_unlock(&outputQueue.lock);
+
+    appendOutputItem(node, node->chunk, node->chunkLength, NULL);
+    node->chunk = NULL;
+    node->chunkLength = 0;
+}
+
+// Publishes the remaining text of a node and marks it as done, the emitter frees it afterwards
+void finishOutput(OutputNode* node) {
+    publishChunk(node);
+
+    pthread_mutex_lock(&outputQueue.lock);
+    node->done = true;
+
+    if(node == outputQueue.head) {
+        pthread_cond_signal(&outputQueue.itemAdded);
+    }
+    pthread_mutex_unlock(&outputQueue.lock);
+}
+
+// Writes the output nodes depth first, starting with the node of the start path
+void* runEmitter(void* arg) {
+    size_t depth = 0;
+    size_t capacity = 64;
+    OutputNode** stack = (OutputNode**)allocateMemory(sizeof(OutputNode*) * capacity);
+
+    stack[depth++] = (OutputNode*)arg;
+
+    pthread_mutex_lock(&outputQueue.lock);
+
+    while(depth > 0) {
+        OutputNode* node = stack[depth - 1];
+
+        while(node->first == NULL && !node->done) {
+            pthread_cond_wait(&outputQueue.itemAdded, &outputQueue.lock);
+        }
+
+        OutputItem* item = node->first;
+
+        if(item == NULL) {
+            free(node);
+            depth--;
+            outputQueue.head = depth > 0 ? stack[depth - 1] : NULL;
+            pthread_cond_broadcast(&outputQueue.spaceFreed);
+            continue;
+        }
+
+        node->first = item->next;
+        if(node->first == NULL) {
+            node->last = NULL;
+        }
+
+        if(item->child != NULL) {
+            if(depth == capacity) {
+                capacity *= 2;
+                stack = (OutputNode**)realloc(stack, sizeof(OutputNode*) * capacity);
+
+                if(stack == NULL) {
+                    fprintf(stderr, "Memory allocation failed.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            stack[depth++] = item->child;
+            outputQueue.head = item->child;
+            pthread_cond_broadcast(&outputQueue.spaceFreed);
+        } else {
+            pthread_mutex_unlock(&outputQueue.lock);
+            writeAll(item->data, item->length);
+            free(item->data);
+            pthread_mutex_lock(&outputQueue.lock);
+
+            outputQueue.bufferedBytes -= item->length;
+            pthread_cond_broadcast(&outputQueue.spaceFreed);
+        }
+        free(item);
+    }
+
+    pthread_mutex_unlock(&outputQueue.lock);
+    free(stack);
+    return NULL;
+}
+
+/* Writes to the output buffer of the thread, or into the output node of the
+current task with -ordered */
+void writeOutput(const char* data, size_t length) {
+    OutputNode* node = currentOutput;
+
+    if(node == NULL) {
+        bufferOutput(data, length);
+        return;
+    }
+
+    while(length > 0) {
+        if(node->chunk == NULL) {
+            node->chunk = (char*)allocateMemory(OUTPUTCHUNKSIZE);
+        }
+
+        size_t space = OUTPUTCHUNKSIZE - node->chunkLength;
+        size_t part = length < space ? length : space;
+
+        memcpy(node->chunk + node->chunkLength, data, part);
+        node->chunkLength += part;
+        data += part;
+        length -= part;
+
+        if(node->chunkLength == OUTPUTCHUNKSIZE) {
+            publishChunk(node);
+        }
+    }
+}
+
+// Writes head, path and a newline as one line
+void writeLine(const char* head, size_t headLength, const char* path, size_t pathLength) {
+    size_t length = headLength + pathLength + 1;
+
+    if(currentOutput != NULL) {
+        if(headLength > 0) {
+            writeOutput(head, headLength);
+        }
+        writeOutput(path, pathLength);
+        writeOutput("\n", 1);
+        return;
+    }
+
+    OutputBuffer* out = &threadOutput;
+
+    if(out->data == NULL) {
+        out->data = (char*)allocateMemory(OUTPUTBUFFERSIZE);
+    }
+
+    if(out->length + length > OUTPUTBUFFERSIZE) {
+        flushOutput();
+    }
+
+    if(length <= OUTPUTBUFFERSIZE) {
+        char* dest = out->data + out->length;
+
+        memcpy(dest, head, headLength);
+        memcpy(dest + headLength, path, pathLength);
+        dest[headLength + pathLength] = '\n';
+        out->length += length;
+    } else {
+        // Too long for the buffer, the pieces are written directly but still in one go
+        pthread_mutex_lock(&writeLock);
+        writeAll(head, headLength);
+        writeAll(path, pathLength);
+        writeAll("\n", 1);
+        pthread_mutex_unlock(&writeLock);
+    }
+
+    if(options.lineBuffered) {
+        flushOutput();
+    }
+}
+
+/* Appends data to the output buffer of the calling thread. Data that does not
+fit into an empty buffer is written directly. */
+void bufferOutput(const char* data, size_t length) {
+    OutputBuffer* out = &threadOutput;
+
+    if(out->data == NULL) {
+        out->data = (char*)allocateMemory(OUTPUTBUFFERSIZE);
+    }
+
+    if(out->length + length > OUTPUTBUFFERSIZE) {
+        flushOutput();
+    }
+
+    if(length > OUTPUTBUFFERSIZE) {
+        pthread_mutex_lock(&writeLock);
+        writeAll(data, length);
+        pthread_mutex_unlock(&writeLock);
+        return;
+    }
+
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+// Writes the output buffer of the calling thread to stdout
+void flushOutput(void) {
+    OutputBuffer* out = &threadOutput;
+
+    if(out->length > 0) {
+        pthread_mutex_lock(&writeLock);
+        writeAll(out->data, out->length);
+        pthread_mutex_unlock(&writeLock);
+        out->length = 0;
+    }
+}
+
+// Writes all of data to stdout, continuing after partial writes
+void writeAll(const char* data, size_t length) {
+    while(length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            error(EXIT_FAILURE, errno, "write() failed.\n");
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+// Prints a formatted message as one piece of output
+void printMessage(const char* format, ...) {
+    char buff[MAXPATHLENGTH + 64];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+
+    if(length > 0) {
+        writeOutput(buff, (size_t)length < sizeof(buff) ? (size_t)length : sizeof(buff) - 1);
+    }
+}
+
+/* Returns the full path of an entry. It is built in walkPath by appending the
+name to the path of the parent directory, which is still in front of it. */
+const char* entryPath(Entry* entry) {
+    if(entry->dirLength == STARTPATH) {
+        truncatePath(0);
+    } else {
+        truncatePath(entry->dirLength);
+        appendPath("/", 1);
+    }
+    appendPath(entry->name, strlen(entry->name));
+    return walkPath.data;
+}
+
+// Cuts walkPath down to length characters and returns it
+const char* truncatePath(size_t length) {
+    if(walkPath.data == NULL) {
+        appendPath("", 0);
+    }
+    walkPath.length = length;
+    walkPath.data[length] = '\0';
+    return walkPath.data;
+}
+
+// Appends characters to walkPath, growing it as needed
+void appendPath(const char* data, size_t length) {
+    PathBuilder* path = &walkPath;
+
+    if(path->length + length + 1 > path->capacity) {
+        size_t capacity = path->capacity == 0 ? MAXPATHLENGTH : path->capacity;
+
+        while(path->length + length + 1 > capacity) {
+            capacity *= 2;
+        }
+
+        char* grown = (char*)allocateMemory(capacity);
+
+        if(path->data != NULL) {
+            memcpy(grown, path->data, path->length);
+            free(path->data);
+        }
+        path->data = grown;
+        path->capacity = capacity;
+    }
+
+    memcpy(path->data + path->length, data, length);
+    path->length += length;
+    path->data[path->length] = '\0';
+}
+
+/* Recreates functionality of "ls" command on CLI. The fields are formatted by
+hand into the line, which is much cheaper than going through printf. */
+void printLs(const char* path, const FileInfo* fileInfo) {
+    time_t time = fileInfo->stx_mtime.tv_sec;
+    // Rounds down so times before 1970 do not share a minute with the ones after it
+    time_t minute = time / 60 - (time % 60 < 0);
+
+    if(!lsTimeValid || minute != lsTimeMinute) {
+        struct tm lastModtime;
+
+        localtime_r(&time, &lastModtime);
+        strftime(lsTimeBuff, 13, "%b %e %H:%M", &lastModtime);
+        lsTimeMinute = minute;
+        lsTimeValid = true;
+    }
+
+    const char* user = cachedName(&userNames, fileInfo->stx_uid);
+    const char* grp = cachedName(&groupNames, fileInfo->stx_gid);
+
+    char head[LSHEADLENGTH];
+    size_t length = 0;
+    char idBuff[16];
+    char bits[11];
+
+    length += formatNumber(head + length, fileInfo->stx_ino, 10);
+    length += formatNumber(head + length, fileInfo->stx_blocks / 2, 7);
+    getFilePermissions(fileInfo->stx_mode, bits);
+    length += formatField(head + length, bits, 11);
+    length += formatNumber(head + length, fileInfo->stx_nlink, 4);
+
+    if(user == NULL) {
+        idBuff[formatNumber(idBuff, fileInfo->stx_uid, 0)] = '\0';
+        user = idBuff;
+    }
+    length += formatField(head + length, user, 11);
+
+    if(grp == NULL) {
+        idBuff[formatNumber(idBuff, fileInfo->stx_gid, 0)] = '\0';
+        grp = idBuff;
+    }
+    length += formatField(head + length, grp, 11);
+
+    length += formatNumber(head + length, fileInfo->stx_size, 10);
+    length += formatField(head + length, lsTimeBuff, 13);
+    head[length++] = ' ';
+
+    // The line is written as one piece, so it stays together when several workers print
+    writeLine(head, length, path, strlen(path));
+}
+
+// Writes value right aligned in a field of at least width characters, returns the characters written
+size_t formatNumber(char* dest, unsigned long value, size_t width) {
+    char digits[24];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value != 0);
+
+    size_t padding = width > count ? width - count : 0;
+
+    memset(dest, ' ', padding);
+    for(size_t i = 0; i < count; i++) {
+        dest[padding + i] = digits[count - 1 - i];
+    }
+    return padding + count;
+}
+
+/* Writes str right aligned in a field of at least width characters, returns
+the characters written. Strings are cut at 255 characters to fit the line buffer. */
+size_t formatField(char* dest, const char* str, size_t width) {
+    size_t count = strnlen(str, 255);
+    size_t padding = width > count ? width - count : 0;
+
+    memset(dest, ' ', padding);
+    memcpy(dest + padding, str, count);
+    return padding + count;
+}
+
+// Returns the name of a user or group ID, NULL if it has none
+const char* cachedName(NameCache* cache, uint32_t id) {
+    if(cache->capacity > 0) {
+        NameCacheSlot* slot = findNameSlot(cache, id);
+
+        if(slot->used) {
+            stats.nameCacheHits++;
+            return slot->name;
+        }
+    }
+
+    stats.nameCacheMisses++;
+
+    // Keeps the load factor below 3/4 so probe sequences stay short
+    if((cache->count + 1) * 4 > cache->capacity * 3) {
+        NameCacheSlot* oldSlots = cache->slots;
+        size_t oldCapacity = cache->capacity;
+
+        cache->capacity = oldCapacity == 0 ? NAMECACHEMIN : oldCapacity * 2;
+        cache->slots = (NameCacheSlot*)allocateMemory(sizeof(NameCacheSlot) * cache->capacity);
+        memset(cache->slots, 0, sizeof(NameCacheSlot) * cache->capacity);
+
+        for(size_t i = 0; i < oldCapacity; i++) {
+            if(oldSlots[i].used) {
+                *findNameSlot(cache, oldSlots[i].id) = oldSlots[i];
+            }
+        }
+        free(oldSlots);
+    }
+
+    NameCacheSlot* slot = findNameSlot(cache, id);
+
+    slot->id = id;
+    slot->used = true;
+    slot->name = lookupName(id, cache->groups);
+    cache->count++;
+
+    return slot->name;
+}
+
+// Returns the slot holding id, or the empty slot where it belongs
+NameCacheSlot* findNameSlot(NameCache* cache, uint32_t id) {
+    size_t mask = cache->capacity - 1;
+    size_t index = (id * 2654435761u) & mask;
+
+    while(cache->slots[index].used && cache->slots[index].id != id) {
+        index = (index + 1) & mask;
+    }
+    return &cache->slots[index];
+}
+
+// Looks up the name of a user or group ID in the database, NULL if it has none
+char* lookupName(uint32_t id, bool group) {
+    size_t buffLength = NAMEBUFLENGTH;
+    char* name = NULL;
+
+    // The reentrant lookups keep this safe when several workers list entries
+    while(true) {
+        char* buff = (char*)allocateMemory(buffLength);
+        int err;
+
+        if(group) {
+            struct group grpEntry;
+            struct group* grp = NULL;
+
+            err = getgrgid_r(id, &grpEntry, buff, buffLength, &grp);
+            if(err == 0 && grp != NULL) {
+                name = strdup(grp->gr_name);
+            }
+        } else {
+            struct passwd userEntry;
+            struct passwd* user = NULL;
+
+            err = getpwuid_r(id, &userEntry, buff, buffLength, &user);
+            if(err == 0 && user != NULL) {
+                name = strdup(user->pw_name);
+            }
+        }
+        free(buff);
+
+        if(err != ERANGE) {
+            return name;
+        }
+        buffLength *= 2;
+    }
+}
+
+// Prints the counters collected during the traversal to stderr
+void printStats(void) {
+    fprintf(stderr, "entries visited:     %lu\n", totalStats.entries);
+    fprintf(stderr, "stat calls:          %lu\n", totalStats.statCalls);
+    fprintf(stderr, "directories read:    %lu\n", totalStats.directories);
+    fprintf(stderr, "getdents calls:      %lu\n", totalStats.dirReads);
+    fprintf(stderr, "io_uring submits:    %lu\n", totalStats.uringSubmits);
+    fprintf(stderr, "name cache hits:     %lu\n", totalStats.nameCacheHits);
+    fprintf(stderr, "name cache misses:   %lu\n", totalStats.nameCacheMisses);
+    fprintf(stderr, "directory reopens:   %lu\n", totalStats.reopens);
+}
+
+// Adds the counters of the calling thread to the totals
+void mergeStats(void) {
+    pthread_mutex_lock(&statsLock);
+    totalStats.entries += stats.entries;
+    totalStats.statCalls += stats.statCalls;
+    totalStats.directories += stats.directories;
+    totalStats.dirReads += stats.dirReads;
+    totalStats.uringSubmits += stats.uringSubmits;
+    totalStats.nameCacheHits += stats.nameCacheHits;
+    totalStats.nameCacheMisses += stats.nameCacheMisses;
+    totalStats.reopens += stats.reopens;
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Prints a path
+void printPath(const char* path) {
+    writeLine("", 0, path, strlen(path));
+}
+
+// Writes file permissions through mode_t flags into bits, which holds 11 characters
+void getFilePermissions(mode_t mode, char* bits) {
+    bits[0] = S_ISDIR(mode) ? 'd' : '-';
+    bits[1] = mode & S_IRUSR ? 'r' : '-';
+    bits[2] = mode & S_IWUSR ? 'w' : '-';
+    bits[3] = mode & S_IXUSR ? 'x' : '-';
+    bits[4] = mode & S_IRGRP ? 'r' : '-';
+    bits[5] = mode & S_IWGRP ? 'w' : '-';
+    bits[6] = mode & S_IXGRP ? 'x' : '-';
+    bits[7] = mode & S_IROTH ? 'r' : '-';
+    bits[8] = mode & S_IWOTH ? 'w' : '-';
+    bits[9] = mode & S_IXOTH ? 'x' : '-';
+    bits[10] = '\0';
+}
+
+/* Resolves a -user argument to a user ID once while parsing, so the test for
+every entry is a plain comparison. A name is looked up in the user database
+first. Otherwise a numeric ID is taken as is, since files can be owned by IDs
+without a user. */
+uid_t resolveUser(const char* user) {
+    unsigned int userId;
+
+    errno = 0;
+
+    if(userExists(user, &userId)) {
+        return (uid_t)userId;
+    }
+
+    if(user[0] != '\0' && isNumeric(user) == true && strlen(user) < 11) {
+        unsigned long numericId = strtoul(user, NULL, 10);
+
+        if(numericId >= (uid_t)-1) {
+            error(EXIT_FAILURE, 0, "Failed converting user ID.\n");
+        }
+        return (uid_t)numericId;
+    }
+
+    error(EXIT_FAILURE, errno, "User does not exist.\n");
+    return (uid_t)-1;
+}
+
+/* Compiles a -name pattern, or an -iname pattern if folded. Patterns with '*'
+only at the ends are matched by comparing their fixed part, others run on a
+GlobNfa. fnmatch() is only left for classes the NFA does not support and very
+long patterns. Folding is ASCII only, which is what fnmatch() does in the C
+locale myfind runs in. */
+NamePattern compilePattern(const char* pattern, bool folded) {
+    NamePattern name = {
+        .pattern = pattern,
+        .kind = folded ? MATCH_FOLDED_FNMATCH : MATCH_FNMATCH,
+        .text = NULL,
+        .length = 0,
+        .nfa = NULL,
+        .block = { 0 }
+    };
+    GlobNfa* nfa = (GlobNfa*)allocateMemory(sizeof(GlobNfa));
+    size_t tokens = 0;
+    size_t leadingStars = 0;
+    bool fixed = true;      // only plain characters between the '*'
+
+    memset(nfa, 0, sizeof(GlobNfa));
+
+    for(const char* pos = pattern; *pos != '\0'; pos++) {
+        if(*pos == '*') {
+            nfa->loops |= 1ULL << tokens;
+            leadingStars += tokens == 0 ? 1 : 0;
+            continue;
+        }
+        if(tokens == GLOBMAXTOKENS) {
+            free(nfa);
+            return name;
+        }
+
+        uint64_t bit = 1ULL << (tokens + 1);
+        bool members[256];
+        int classLength = *pos == '[' ? parseClass(pos, members, folded) : 0;
+
+        if(classLength < 0) {
+            free(nfa);
+            return name;
+        }
+
+        if(*pos == '?') {
+            memset(members, true, sizeof(members));
+            fixed = false;
+        } else if(classLength > 0) {
+            pos += classLength - 1;
+            fixed = false;
+        } else {
+            // A '[' without its ']' is a plain character
+            memset(members, false, sizeof(members));
+            members[folded ? foldCase((unsigned char)*pos) : (unsigned char)*pos] = true;
+            fixed = fixed && *pos != '[';
+        }
+
+        // Like fnmatch(), a folded character is accepted if its lower case is a member
+        for(int c = 1; c < 256; c++) {
+            if(members[folded ? foldCase((unsigned char)c) : c]) {
+                nfa->accepts[c] |= bit;
+            }
+        }
+        tokens++;
+    }
+
+    nfa->final = 1ULL << tokens;
+
+    // The '*' of a fixed pattern can only be at its ends to be compared directly
+    uint64_t ends = 1ULL | nfa->final;
+
+    if(fixed && (nfa->loops & ~ends) == 0) {
+        name.text = pattern + leadingStars;
+        name.length = tokens;
+
+        if(nfa->loops == 0) {
+            name.kind = folded ? MATCH_FOLDED_LITERAL : MATCH_LITERAL;
+        } else if(nfa->loops == nfa->final) {
+            name.kind = folded ? MATCH_FOLDED_PREFIX : MATCH_PREFIX;
+        } else if(nfa->loops == 1) {
+            name.kind = folded ? MATCH_FOLDED_SUFFIX : MATCH_SUFFIX;
+        } else {
+            name.kind = folded ? MATCH_FOLDED_CONTAINS : MATCH_CONTAINS;
+        }
+
+        if(folded) {
+            char* lower = (char*)allocateMemory(tokens + 1);
+
+            for(size_t i = 0; i <= tokens; i++) {
+                lower[i] = (char)foldCase((unsigned char)name.text[i]);
+            }
+            name.text = lower;
+        }
+
+        // -path continues matching on the NFA from the state after the directory, NameSets run the folded kinds on it
+        name.nfa = nfa;
+
+        if(tokens <= sizeof(name.block)) {
+            memcpy(name.block, name.text, tokens);
+        }
+        return name;
+    }
+
+    name.kind = MATCH_GLOB;
+    name.nfa = nfa;
+    return name;
+}
+
+/* Reads the [...] class at the start of pattern into members like fnmatch()
+does: '!' or '^' negates it, a ']' right after the opening is a member and
+'-' between two characters is a range. If folded, characters and the ends of
+ranges are taken in lower case. Returns the length of the class, 0 if it is
+not closed, which makes the '[' a plain character, and -1 for what is left to
+fnmatch(): [:class:], [=equiv=], [.symbol.], reversed ranges and unclosed
+classes with a '-'. */
+int parseClass(const char* pattern, bool* members, bool folded) {
+    const char* pos = pattern + 1;
+    bool negate = *pos == '!' || *pos == '^';
+
+    memset(members, 0, sizeof(bool) * 256);
+    pos += negate ? 1 : 0;
+
+    const char* first = pos;
+
+    while(*pos != '\0' && (*pos != ']' || pos == first)) {
+        unsigned char low = folded ? foldCase((unsigned char)*pos) : (unsigned char)*pos;
+
+        if(*pos == '[' && (pos[1] == ':' || pos[1] == '=' || pos[1] == '.')) {
+            return -1;
+        }
+
+        if(pos[1] == '-' && pos[2] != ']' && pos[2] != '\0') {
+            unsigned char high = folded ? foldCase((unsigned char)pos[2]) : (unsigned char)pos[2];
+
+            if(high < low) {
+                return -1;
+            }
+            for(unsigned int c = low; c <= high; c++) {
+                members[c] = true;
+            }
+            pos += 3;
+        } else {
+            members[low] = true;
+            pos++;
+        }
+    }
+
+    if(*pos == '\0') {
+        // fnmatch() treats an open range at the end of the pattern specially
+        return strchr(first, '-') != NULL ? -1 : 0;
+    }
+
+    if(negate) {
+        for(int c = 0; c < 256; c++) {
+            members[c] = !members[c];
+        }
+    }
+    return (int)(pos - pattern) + 1;
+}
+
+// Folds an ASCII letter to lower case
+unsigned char foldCase(unsigned char c) {
+    return (unsigned int)(c - 'A') < 26u ? (unsigned char)(c + 'a' - 'A') : c;
+}
+
+// Runs a string through a compiled glob, stops as soon as no state is left
+bool runGlob(const GlobNfa* nfa, const char* str) {
+    uint64_t state = 1;
+
+    for(const unsigned char* pos = (const unsigned char*)str; *pos != '\0'; pos++) {
+        state = ((state << 1) & nfa->accepts[*pos]) | (state & nfa->loops);
+
+        if(state == 0) {
+            return false;
+        }
+    }
+    return (state & nfa->final) != 0;
+}
+
+// Moves a glob state over length characters, stops as soon as no state is left
+uint64_t advanceGlob(const GlobNfa* nfa, uint64_t state, const char* str, size_t length) {
+    const unsigned char* pos = (const unsigned char*)str;
+
+    for(size_t i = 0; i < length && state != 0; i++) {
+        state = ((state << 1) & nfa->accepts[pos[i]]) | (state & nfa->loops);
+    }
+    return state;
+}
+
+// Checks if a NameSet matches a pattern on its NFA, the case sensitive fixed kinds go to the tries
+bool runsAsGlob(const NamePattern* name) {
+    return name->kind == MATCH_GLOB || (name->kind >= MATCH_FOLDED_LITERAL && name->kind <= MATCH_FOLDED_CONTAINS);
+}
+
+/* Compiles the -name patterns of an -o group into one NameSet. The texts are
+not copied, they point into the patterns, which live as long as the program. */
+NameSet* createNameSet(const NamePattern** patterns, size_t count) {
+    NameSet* set = (NameSet*)allocateMemory(sizeof(NameSet));
+    size_t literalCount = 0;
+    size_t globCount = 0;
+
+    memset(set, 0, sizeof(NameSet));
+    set->others = (NamePattern*)allocateMemory(sizeof(NamePattern) * count);
+
+    for(size_t i = 0; i < count; i++) {
+        literalCount += patterns[i]->kind == MATCH_LITERAL ? 1 : 0;
+        globCount += runsAsGlob(patterns[i]) ? 1 : 0;
+        set->matchAll = set->matchAll || ((patterns[i]->kind == MATCH_PREFIX || patterns[i]->kind == MATCH_FOLDED_PREFIX) && patterns[i]->length == 0);
+
+        if(patterns[i]->kind == MATCH_FNMATCH || patterns[i]->kind == MATCH_FOLDED_FNMATCH) {
+            set->others[set->otherCount++] = *patterns[i];
+        }
+    }
+
+    if(literalCount > 0) {
+        size_t slots = 4;
+
+        while(slots < literalCount * 2) {
+            slots *= 2;
+        }
+        set->literals = (const char**)allocateMemory(sizeof(char*) * slots);
+        set->literalHashes = (uint64_t*)allocateMemory(sizeof(uint64_t) * slots);
+        set->literalMask = slots - 1;
+        memset(set->literals, 0, sizeof(char*) * slots);
+
+        for(size_t i = 0; i < count; i++) {
+            if(patterns[i]->kind != MATCH_LITERAL) {
+                continue;
+            }
+            uint64_t hash = hashBytes(patterns[i]->text, patterns[i]->length);
+            size_t slot = hash & set->literalMask;
+
+            while(set->literals[slot] != NULL && strcmp(set->literals[slot], patterns[i]->text) != 0) {
+                slot = (slot + 1) & set->literalMask;
+            }
+            set->literals[slot] = patterns[i]->text;
+            set->literalHashes[slot] = hash;
+        }
+    }
+
+    set->prefixes = createTrie(patterns, count, MATCH_PREFIX);
+    set->suffixes = createTrie(patterns, count, MATCH_SUFFIX);
+    set->contains = createTrie(patterns, count, MATCH_CONTAINS);
+    set->globs = globCount > 0 ? createGlobSet(patterns, count) : NULL;
+
+    if(set->contains != NULL) {
+        addFailureLinks(set->contains);
+    }
+    return set;
+}
+
+/* Builds a trie of the fixed parts of the patterns of one kind, suffixes are
+inserted reversed. Returns NULL if there are none. */
+NameTrie* createTrie(const NamePattern** patterns, size_t count, MatchKind kind) {
+    size_t maxNodes = 1;
+    bool used[256] = { false };
+
+    for(size_t i = 0; i < count; i++) {
+        if(patterns[i]->kind == kind) {
+            maxNodes += patterns[i]->length;
+
+            for(size_t j = 0; j < patterns[i]->length; j++) {
+                used[(unsigned char)patterns[i]->text[j]] = true;
+            }
+        }
+    }
+
+    if(maxNodes == 1) {
+        return NULL;
+    }
+
+    NameTrie* trie = (NameTrie*)allocateMemory(sizeof(NameTrie));
+
+    trie->columnCount = 1;
+
+    for(int c = 0; c < 256; c++) {
+        trie->columns[c] = used[c] ? (uint8_t)trie->columnCount++ : 0;
+    }
+    trie->next = (uint32_t*)allocateMemory(sizeof(uint32_t) * maxNodes * trie->columnCount);
+    trie->terminal = (bool*)allocateMemory(sizeof(bool) * maxNodes);
+    trie->nodeCount = 1;
+    memset(trie->next, 0, sizeof(uint32_t) * maxNodes * trie->columnCount);
+    memset(trie->terminal, 0, sizeof(bool) * maxNodes);
+
+    for(size_t i = 0; i < count; i++) {
+        if(patterns[i]->kind != kind) {
+            continue;
+        }
+        const char* text = patterns[i]->text;
+        size_t length = patterns[i]->length;
+        uint32_t node = 0;
+
+        for(size_t j = 0; j < length; j++) {
+            unsigned char c = (unsigned char)text[kind == MATCH_SUFFIX ? length - 1 - j : j];
+            uint32_t* edge = &trie->next[node * trie->columnCount + trie->columns[c]];
+
+            if(*edge == 0) {
+                *edge = (uint32_t)trie->nodeCount++;
+            }
+            node = *edge;
+        }
+        trie->terminal[node] = true;
+    }
+    return trie;
+}
+
+/* Turns a trie into an Aho-Corasick automaton: missing transitions are filled
+in with those of the longest proper suffix that is in the trie, and a node is
+terminal if a pattern ends at any of its suffixes. Nodes are visited in
+breadth first order, which is the order of their depth. */
+void addFailureLinks(NameTrie* trie) {
+    size_t columns = trie->columnCount;
+    uint32_t* fail = (uint32_t*)allocateMemory(sizeof(uint32_t) * trie->nodeCount);
+    uint32_t* queue = (uint32_t*)allocateMemory(sizeof(uint32_t) * trie->nodeCount);
+    size_t head = 0;
+    size_t tail = 0;
+
+    queue[tail++] = 0;
+    fail[0] = 0;
+
+    while(head < tail) {
+        uint32_t node = queue[head++];
+
+        for(size_t c = 0; c < columns; c++) {
+            uint32_t* edge = &trie->next[node * columns + c];
+            uint32_t fallback = node == 0 ? 0 : trie->next[fail[node] * columns + c];
+
+            if(*edge == 0) {
+                *edge = fallback;
+                continue;
+            }
+            fail[*edge] = fallback;
+            trie->terminal[*edge] = trie->terminal[*edge] || trie->terminal[fallback];
+            queue[tail++] = *edge;
+        }
+    }
+
+    free(queue);
+    free(fail);
+}
+
+/* Lays the GlobNfa of every pattern that runsAsGlob() side by side. A glob of
+n tokens takes n + 1 states, the first of which is its start state. */
+GlobSet* createGlobSet(const NamePattern** patterns, size_t count) {
+    GlobSet* globs = (GlobSet*)allocateMemory(sizeof(GlobSet));
+    size_t states = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(runsAsGlob(patterns[i])) {
+            states += (size_t)__builtin_ctzll(patterns[i]->nfa->final) + 1;
+        }
+    }
+    globs->words = (states + 63) / 64;
+    globs->accepts = (uint64_t*)allocateMemory(sizeof(uint64_t) * globs->words * 259);
+    globs->loops = globs->accepts + globs->words * 256;
+    globs->starts = globs->loops + globs->words;
+    globs->finals = globs->starts + globs->words;
+    memset(globs->accepts, 0, sizeof(uint64_t) * globs->words * 259);
+
+    size_t base = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(!runsAsGlob(patterns[i])) {
+            continue;
+        }
+        const GlobNfa* nfa = patterns[i]->nfa;
+        size_t tokens = (size_t)__builtin_ctzll(nfa->final);
+
+        for(size_t state = 0; state <= tokens; state++) {
+            size_t word = (base + state) / 64;
+            uint64_t bit = 1ULL << ((base + state) % 64);
+
+            for(int c = 0; c < 256; c++) {
+                if(nfa->accepts[c] & (1ULL << state)) {
+                    globs->accepts[c * globs->words + word] |= bit;
+                }
+            }
+            if(nfa->loops & (1ULL << state)) {
+                globs->loops[word] |= bit;
+            }
+            if(state == 0) {
+                globs->starts[word] |= bit;
+            }
+            if(state == tokens) {
+                globs->finals[word] |= bit;
+            }
+        }
+        base += tokens + 1;
+    }
+
+    initDfa(&globs->dfa, stepGlobSet, globs, globs->words, globs->starts, globs->finals);
+    return globs;
+}
+
+// Moves the states of all globs of a GlobSet over one character, like runGlob() with the shift carried from word to word
+void stepGlobSet(const void* automaton, const uint64_t* from, unsigned char c, uint64_t* to) {
+    const GlobSet* globs = (const GlobSet*)automaton;
+    const uint64_t* accepts = &globs->accepts[c * globs->words];
+    uint64_t carry = 0;
+
+    for(size_t w = 0; w < globs->words; w++) {
+        to[w] = (((from[w] << 1) | carry) & accepts[w]) | (from[w] & globs->loops[w]);
+        carry = from[w] >> 63;
+    }
+}
+
+// Sets up an empty LazyDfa with its dead and start states
+void initDfa(LazyDfa* dfa, void (*step)(const void*, const uint64_t*, unsigned char, uint64_t*), const void* automaton, size_t words, const uint64_t* starts, const uint64_t* finals) {
+    size_t slots = 4;
+    uint64_t* empty = (uint64_t*)allocateMemory(sizeof(uint64_t) * words);
+
+    while(slots < DFAMAXSTATES * 2) {
+        slots *= 2;
+    }
+
+    dfa->words = words;
+    dfa->step = step;
+    dfa->automaton = automaton;
+    dfa->finals = finals;
+    dfa->sets = (uint64_t*)allocateMemory(sizeof(uint64_t) * words * DFAMAXSTATES);
+    dfa->accepting = (bool*)allocateMemory(sizeof(bool) * DFAMAXSTATES);
+    dfa->table = (int*)allocateMemory(sizeof(int) * slots);
+    dfa->tableMask = slots - 1;
+    dfa->stateCount = 0;
+    memset(dfa->table, -1, sizeof(int) * slots);
+    memset(empty, 0, sizeof(uint64_t) * words);
+    pthread_mutex_init(&dfa->lock, NULL);
+
+    addDfaState(dfa, empty);
+    addDfaState(dfa, starts);
+    free(empty);
+}
+
+/* Returns the state of a set of automaton states, adds it if it is new. Only
+called under the lock or before the DFA is shared. Returns -1 if the DFA is
+full. */
+int addDfaState(LazyDfa* dfa, const uint64_t* set) {
+    size_t size = sizeof(uint64_t) * dfa->words;
+    size_t slot = hashBytes(set, size) & dfa->tableMask;
+
+    while(dfa->table[slot] >= 0) {
+        if(memcmp(&dfa->sets[(size_t)dfa->table[slot] * dfa->words], set, size) == 0) {
+            return dfa->table[slot];
+        }
+        slot = (slot + 1) & dfa->tableMask;
+    }
+
+    if(dfa->stateCount == DFAMAXSTATES) {
+        return -1;
+    }
+
+    int state = dfa->stateCount;
+    atomic_int* row = (atomic_int*)allocateMemory(sizeof(atomic_int) * 256);
+    bool accepting = false;
+
+    for(size_t w = 0; w < dfa->words; w++) {
+        accepting = accepting || (set[w] & dfa->finals[w]) != 0;
+    }
+    for(int c = 0; c < 256; c++) {
+        atomic_init(&row[c], state == 0 ? 0 : -1);
+    }
+    memcpy(&dfa->sets[(size_t)state * dfa->words], set, size);
+    dfa->accepting[state] = accepting;
+    dfa->rows[state] = row;
+    dfa->table[slot] = state;
+    dfa->stateCount++;
+    return state;
+}
+
+/* Computes the transition of a state over a character and publishes it.
+Returns the target state, -1 if it is a new set and the DFA is full. */
+int addDfaTransition(LazyDfa* dfa, int state, unsigned char c) {
+    uint64_t target[dfa->words];
+
+    pthread_mutex_lock(&dfa->lock);
+
+    int next = atomic_load_explicit(&dfa->rows[state][c], memory_order_relaxed);
+
+    if(next < 0) {
+        dfa->step(dfa->automaton, &dfa->sets[(size_t)state * dfa->words], c, target);
+        next = addDfaState(dfa, target);
+
+        if(next >= 0) {
+            // The release orders the new state before the transition to it
+            atomic_store_explicit(&dfa->rows[state][c], next, memory_order_release);
+        }
+    }
+
+    pthread_mutex_unlock(&dfa->lock);
+    return next;
+}
+
+/* Runs a string through a LazyDfa, stops as soon as no automaton state is
+left. Past a full DFA the rest of the string is stepped on the automaton. */
+bool runDfa(LazyDfa* dfa, const char* str) {
+    int state = 1;
+
+    for(const unsigned char* pos = (const unsigned char*)str; *pos != '\0'; pos++) {
+        int next = atomic_load_explicit(&dfa->rows[state][*pos], memory_order_acquire);
+
+        if(next < 0) {
+            next = addDfaTransition(dfa, state, *pos);
+        }
+
+        if(next < 0) {
+            uint64_t current[dfa->words];
+            uint64_t following[dfa->words];
+            bool accepting = false;
+
+            memcpy(current, &dfa->sets[(size_t)state * dfa->words], sizeof(current));
+
+            for(; *pos != '\0'; pos++) {
+                dfa->step(dfa->automaton, current, *pos, following);
+                memcpy(current, following, sizeof(current));
+            }
+            for(size_t w = 0; w < dfa->words; w++) {
+                accepting = accepting || (current[w] & dfa->finals[w]) != 0;
+            }
+            return accepting;
+        }
+
+        if(next == 0) {
+            return false;
+        }
+        state = next;
+    }
+    return dfa->accepting[state];
+}
+
+/* Moves a DFA state over length characters. Returns -1 if the DFA is full
+before the end, the caller then has to match the whole string with runDfa(). */
+int advanceDfa(LazyDfa* dfa, int state, const char* str, size_t length) {
+    const unsigned char* pos = (const unsigned char*)str;
+
+    for(size_t i = 0; i < length && state > 0; i++) {
+        int next = atomic_load_explicit(&dfa->rows[state][pos[i]], memory_order_acquire);
+
+        state = next >= 0 ? next : addDfaTransition(dfa, state, pos[i]);
+    }
+    return state;
+}
+
+// Hashes a byte string eight bytes at a time, for the open addressing tables
+uint64_t hashBytes(const void* data, size_t length) {
+    const char* bytes = (const char*)data;
+    const char* end = bytes + length;
+    uint64_t hash = length * 0x9e3779b97f4a7c15ULL;
+    uint64_t word = 0;
+
+    for(; end - bytes > (ptrdiff_t)sizeof(word); bytes += sizeof(word)) {
+        memcpy(&word, bytes, sizeof(word));
+        hash = ((hash << 23 | hash >> 41) ^ word) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    // The last one to eight bytes, loaded so that no byte outside the string is read
+    if(length >= 8) {
+        memcpy(&word, end - 8, 8);
+    } else if(length >= 4) {
+        uint32_t low;
+        uint32_t high;
+
+        memcpy(&low, bytes, 4);
+        memcpy(&high, end - 4, 4);
+        word = (uint64_t)high << 32 | low;
+    } else if(length > 0) {
+        word = (uint64_t)(unsigned char)bytes[0] << 16 | (uint64_t)(unsigned char)bytes[length / 2] << 8 | (unsigned char)end[-1];
+    }
+    hash = ((hash << 23 | hash >> 41) ^ word) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ hash >> 32;
+}
+
+/* Compiles a -regex argument, a POSIX extended regular expression that has to
+match the whole path like in find. Unlike find, which reads emacs syntax unless
+it is given -regextype, '(', '|' and '{' are always operators here. The
+expression is compiled by re_compile_pattern() first, with the syntax of find
+-regextype posix-extended, so every error is reported the same way. Classes,
+'.', groups, '|' and the repeats *, +, ? and {m,n} are compiled into a
+RegexNfa. Back references, anchors other than a leading '^' and a trailing '$',
+the GNU escapes like \w and [.symbol.] or [=equiv=] keep the expression on
+re_match(). */
+RegexTest* compileRegex(const char* pattern, bool folded) {
+    RegexTest* test = (RegexTest*)allocateMemory(sizeof(RegexTest));
+    size_t length = strlen(pattern);
+    size_t backslashes = 0;     // in front of the last character
+
+    test->compiled = (regex_t*)allocateMemory(sizeof(regex_t));
+    memset(test->compiled, 0, sizeof(regex_t));
+    re_set_syntax(RE_SYNTAX_POSIX_EXTENDED | (folded ? RE_ICASE : 0));
+
+    const char* error = re_compile_pattern(pattern, length, test->compiled);
+
+    if(error != NULL) {
+        fprintf(stderr, "Invalid regular expression %s: %s.\n", pattern, error);
+        exit(EXIT_FAILURE);
+    }
+
+    test->pattern = pattern;
+    test->nfa = NULL;
+    test->filtered = false;
+    test->slot = 0;
+
+    while(backslashes + 1 < length && pattern[length - backslashes - 2] == '\\') {
+        backslashes++;
+    }
+
+    RegexParser parser = {
+        .pos = pattern,
+        .end = pattern + length,
+        .folded = folded,
+        .unsupported = false,
+        .nodes = 0,
+        .depth = 0
+    };
+
+    // The match covers the whole path anyway, so anchors at its ends change nothing
+    parser.pos += pattern[0] == '^' ? 1 : 0;
+
+    if(length > 1 && pattern[length - 1] == '$' && backslashes % 2 == 0 && parser.end > parser.pos) {
+        parser.end--;
+    }
+
+    RegexNode* root = parseRegexAlternation(&parser);
+    size_t classes = countRegexClasses(root);
+
+    if(!parser.unsupported && parser.pos == parser.end && classes < REGEXMAXSTATES) {
+        char run[GLOBMAXTOKENS];
+        char best[GLOBMAXTOKENS + 3];
+        size_t runLength = 0;
+        size_t bestLength = 0;
+
+        test->nfa = createRegexNfa(root, classes);
+        regfree(test->compiled);
+        free(test->compiled);
+        test->compiled = NULL;
+
+        // The literal becomes the "*text*" glob of a MATCH_CONTAINS pattern
+        findRegexLiteral(root, folded, run, &runLength, best + 1, &bestLength);
+
+        if(bestLength >= 2) {
+            best[0] = '*';
+            best[bestLength + 1] = '*';
+            best[bestLength + 2] = '\0';
+            test->prefilter = compilePattern(strdup(best), folded);
+            test->filtered = true;
+        }
+    }
+
+    freeRegexNode(root);
+    return test;
+}
+
+// Parses branches joined by '|'
+RegexNode* parseRegexAlternation(RegexParser* parser) {
+    RegexNode* node = parseRegexSequence(parser);
+
+    while(!parser->unsupported && parser->pos < parser->end && *parser->pos == '|') {
+        parser->pos++;
+        node = createRegexNode(parser, REGEX_ALTERNATE, node, parseRegexSequence(parser));
+    }
+    return node;
+}
+
+/* Parses the repeated atoms of one branch. Empty branches and groups are left
+to re_match(), it decides what they mean. */
+RegexNode* parseRegexSequence(RegexParser* parser) {
+    RegexNode* node = NULL;
+
+    while(!parser->unsupported && parser->pos < parser->end && *parser->pos != '|' &&
+          (*parser->pos != ')' || parser->depth == 0)) {
+        RegexNode* atom = parseRegexRepeat(parser);
+
+        node = node == NULL ? atom : createRegexNode(parser, REGEX_CONCAT, node, atom);
+    }
+
+    if(node == NULL) {
+        parser->unsupported = true;
+        node = createRegexNode(parser, REGEX_EMPTY, NULL, NULL);
+    }
+    return node;
+}
+
+// Parses an atom and the *, +, ? and {m,n} after it
+RegexNode* parseRegexRepeat(RegexParser* parser) {
+    RegexNode* node = parseRegexAtom(parser);
+
+    while(!parser->unsupported && parser->pos < parser->end) {
+        char c = *parser->pos;
+        long low = 0;
+        long high = -1;     // no upper bound
+
+        if(c == '*') {
+            parser->pos++;
+        } else if(c == '+') {
+            low = 1;
+            parser->pos++;
+        } else if(c == '?') {
+            high = 1;
+            parser->pos++;
+        } else if(c == '{') {
+            parser->pos++;
+
+            if(!parseRegexCount(parser, &low)) {
+                break;
+            }
+            high = low;
+
+            if(parser->pos < parser->end && *parser->pos == ',') {
+                parser->pos++;
+                high = -1;
+
+                if(parser->pos < parser->end && *parser->pos != '}' && !parseRegexCount(parser, &high)) {
+                    break;
+                }
+            }
+            if(parser->pos == parser->end || *parser->pos != '}' || (high >= 0 && high < low)) {
+                parser->unsupported = true;
+                break;
+            }
+            parser->pos++;
+        } else {
+            break;
+        }
 
-typedef struct stat FileInfo;
+        // The copies are counted before they are made, counts like {1000} would not fit anyway
+        size_t copies = (size_t)(high >= 0 ? high : low + 1);
 
-typedef struct parameter {
-    char* name;
-    char* value;
-} Parameter;
+        if(parser->nodes + countRegexNodes(node) * (copies + 1) * 2 > REGEXMAXNODES) {
+            parser->unsupported = true;
+            break;
+        }
 
-typedef struct parameterNode {
-    Parameter* param;
-    struct parameterNode* next;
-} ParameterNode;
+        RegexNode* repeated = NULL;
 
-Parameter* createParameter(const char* name, const char* value);
-ParameterNode* parseParams(int argc, char* argv[], char* path);
-ParameterNode* appendParameter(ParameterNode* head, Parameter* param);
-bool typeExists(const char* type);
-void verifyArgument(int argc, char* argv[], int index);
-void exitOnNull(Parameter* param, const char* paramName);
-void* allocateMemory(size_t size);
-bool stringStartsWith(const char *pre, const char *str);
-bool isNumeric(const char* str);
-void doEntry(const char* entry_name, ParameterNode* params);
-void doDirectory(const char* dir_name, ParameterNode* params);
-char* getFilePermissions(mode_t mode);
-void concatPath(char* dest, const char* arg1, const char* arg2);
-void printLs(const char* path, FileInfo* fileInfo);
-void printPath(const char* path);
-bool compUser(const FileInfo* fi, const char* user);
-bool compPath(const char* name, const char* path);
-bool matchPath(const char* pattern, const char* path);
-bool compType(const FileInfo* fileInfo, char type);
-bool hasNoUser(const FileInfo* fileInfo);
+        for(long i = 0; i < low; i++) {
+            RegexNode* copy = i == 0 ? node : copyRegexNode(parser, node);
 
-int main(int argc, char* argv[]) {
-    char* path = (char*)allocateMemory(sizeof(char) * MAXPATHLENGTH);
-    ParameterNode* params = parseParams(argc, argv, path);
+            repeated = repeated == NULL ? copy : createRegexNode(parser, REGEX_CONCAT, repeated, copy);
+        }
+        for(long i = low; i < high; i++) {
+            RegexNode* copy = i == 0 ? node : copyRegexNode(parser, node);
+            RegexNode* optional = createRegexNode(parser, REGEX_ALTERNATE, copy, createRegexNode(parser, REGEX_EMPTY, NULL, NULL));
 
-    doEntry(path, params);
+            repeated = repeated == NULL ? optional : createRegexNode(parser, REGEX_CONCAT, repeated, optional);
+        }
+        if(high < 0) {
+            RegexNode* star = createRegexNode(parser, REGEX_STAR, low == 0 ? node : copyRegexNode(parser, node), NULL);
 
-    return 0;
+            repeated = repeated == NULL ? star : createRegexNode(parser, REGEX_CONCAT, repeated, star);
+        }
+        if(repeated == NULL) {
+            // x{0} or x{0,0} matches the empty string only
+            freeRegexNode(node);
+            repeated = createRegexNode(parser, REGEX_EMPTY, NULL, NULL);
+        }
+        node = repeated;
+    }
+    return node;
 }
 
-// Checks argc and argv for used parameters
-ParameterNode* parseParams(int argc, char* argv[], char* path) {
-    ParameterNode* head = (ParameterNode*)malloc(sizeof(ParameterNode));
+/* Parses a character, '.', a bracket expression or a group. Operators without
+an operand, anchors and escaped letters, digits and GNU operators mark the
+expression unsupported. */
+RegexNode* parseRegexAtom(RegexParser* parser) {
+    RegexNode* node = createRegexNode(parser, REGEX_CLASS, NULL, NULL);
+    unsigned char c = (unsigned char)*parser->pos++;
 
-    strncpy(path, ".", MAXPATHLENGTH);
+    switch(c) {
+        case '(':
+            freeRegexNode(node);
+
+            if(++parser->depth > REGEXMAXDEPTH) {
+                parser->unsupported = true;
+                return createRegexNode(parser, REGEX_EMPTY, NULL, NULL);
+            }
+            node = parseRegexAlternation(parser);
+
+            if(parser->pos == parser->end || *parser->pos != ')') {
+                parser->unsupported = true;
+            } else {
+                parser->pos++;
+            }
+            parser->depth--;
+            return node;
+        case '.':
+            memset(node->accepts, 0xff, sizeof(node->accepts));
+            node->accepts[0] &= ~1ULL;
+            return node;
+        case '[':
+            parser->unsupported = !parseRegexBracket(parser, node->accepts);
+            return node;
+        case '\\':
+            c = (unsigned char)*parser->pos++;
 
-    if(argc == 1) {
-        appendParameter(head, createParameter("-print", NULL));
-        return head;
+            if(isalnum(c) || c == '<' || c == '>' || c == '`' || c == '\'') {
+                parser->unsupported = true;
+            }
+            break;
+        case ')': case '*': case '+': case '?': case '{': case '^': case '$':
+            parser->unsupported = true;
+            break;
+        default:
+            break;
     }
 
-    bool outputSet = false;
+    // Like re_match() with RE_ICASE, a folded character is accepted if its lower case is the one of the pattern
+    for(int other = 1; other < 256; other++) {
+        if((parser->folded ? foldCase((unsigned char)other) : other) == (parser->folded ? foldCase(c) : c)) {
+            node->accepts[other / 64] |= 1ULL << (other % 64);
+        }
+    }
+    return node;
+}
 
-    for (int i = 1; i < argc; i++) {
+/* Reads a bracket expression like regcomp() does in the C locale, pos is
+after the '['. A ']' right after the opening is a member, '-' between two
+characters is a range and [:class:] names a character class. Folded members
+and ends of ranges are taken in lower case, [:upper:] and [:lower:] become
+[:alpha:] like in regcomp(). Returns false for [.symbol.], [=equiv=], ranges
+with those at their ends and reversed ranges. */
+bool parseRegexBracket(RegexParser* parser, uint64_t* accepts) {
+    bool members[256] = { false };
+    bool negate = parser->pos < parser->end && *parser->pos == '^';
+    const char* first = parser->pos + (negate ? 1 : 0);
+    const char* pos = first;
 
-        if (stringStartsWith("-", argv[i])) {
-            if(strcmp("-user", argv[i]) == 0) {
-                verifyArgument(argc, argv, i);
-                Parameter* userParam = createParameter(argv[i], argv[i+1]);
-                exitOnNull(userParam, argv[i]);
-                appendParameter(head, userParam);
-                i++;
-            } else if(strcmp("-name", argv[i]) == 0) {
-                verifyArgument(argc, argv, i);
+    while(pos < parser->end && (*pos != ']' || pos == first)) {
+        if(pos[0] == '[' && (pos[1] == '.' || pos[1] == '=')) {
+            return false;
+        }
 
-                Parameter* nameParam = createParameter(argv[i], argv[i + 1]);
-                exitOnNull(nameParam, argv[i]);
-                appendParameter(head, nameParam);
-                i++;
-            } else if(strcmp("-type", argv[i]) == 0) {
-                verifyArgument(argc, argv, i);
+        if(pos[0] == '[' && pos[1] == ':') {
+            const char* close = strstr(pos + 2, ":]");
+            static const struct { const char* name; int (*test)(int); } classes[] = {
+                { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum }, { "upper", isupper },
+                { "lower", islower }, { "space", isspace }, { "blank", isblank }, { "punct", ispunct },
+                { "print", isprint }, { "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit }
+            };
+            size_t length = close != NULL ? (size_t)(close - pos - 2) : 0;
+            int (*test)(int) = NULL;
 
-                if (!typeExists(argv[i+1])) {
-                    fprintf(stderr, "Type does not exist.\n");
-                    exit(1);
+            for(size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+                if(strlen(classes[i].name) == length && strncmp(classes[i].name, pos + 2, length) == 0) {
+                    test = parser->folded && (classes[i].test == isupper || classes[i].test == islower) ? isalpha : classes[i].test;
                 }
+            }
+            if(test == NULL) {
+                return false;
+            }
+            for(int c = 1; c < 256; c++) {
+                members[c] = members[c] || test(c) != 0;
+            }
+            pos = close + 2;
 
-                Parameter* typeParam = createParameter(argv[i], argv[i+1]);
-                exitOnNull(typeParam, argv[i]);
-                appendParameter(head, typeParam);
-                i++; 
-            } else if(strcmp("-ls", argv[i]) == 0) {
-                Parameter* lsParam = createParameter(argv[i], NULL);
-                exitOnNull(lsParam, argv[i]);
-                appendParameter(head, lsParam);
-                outputSet = true;
-            } else {
-                fprintf(stderr, "%s is not a valid command.\n", argv[i]);
-                exit(EXIT_FAILURE);
+            // A class can not end a range
+            if(pos[0] == '-' && pos[1] != ']') {
+                return false;
             }
-        } else {
-            if(i == 1) {
-                strncpy(path, argv[i], MAXPATHLENGTH);
-            } else {
-                fprintf(stderr, "%s is not a valid command.\n", argv[i]);
-                exit(EXIT_FAILURE);
+            continue;
+        }
+
+        unsigned char low = parser->folded ? foldCase((unsigned char)*pos) : (unsigned char)*pos;
+
+        if(pos[1] == '-' && pos + 2 < parser->end && pos[2] != ']') {
+            unsigned char high = parser->folded ? foldCase((unsigned char)pos[2]) : (unsigned char)pos[2];
+
+            if(pos[2] == '[' || high < low) {
+                return false;
             }
+            for(unsigned int c = low; c <= high; c++) {
+                members[c] = true;
+            }
+            pos += 3;
+        } else {
+            members[low] = true;
+            pos++;
         }
     }
 
-    if(outputSet == false) {
-        appendParameter(head, createParameter("-print", NULL));
+    if(pos == parser->end) {
+        return false;
     }
-    return head;
-}
+    parser->pos = pos + 1;
 
-// Checks if an argument that needs a variable has one
-void verifyArgument(int argc, char* argv[], int index) {
-    if((index + 1) >= argc) {
-        fprintf(stderr, "No argument provided for %s.\n", argv[index]);
-        exit(1);
+    for(int c = 1; c < 256; c++) {
+        if(members[parser->folded ? foldCase((unsigned char)c) : c] != negate) {
+            accepts[c / 64] |= 1ULL << (c % 64);
+        }
     }
+    return true;
 }
 
-// Checks if a user exists in user database
-bool userExists(const char* username, unsigned int* userId) {
-    struct passwd* user = getpwnam(username);
+// Reads the number of a {m,n} repeat, marks the expression unsupported if there is none
+bool parseRegexCount(RegexParser* parser, long* count) {
+    const char* start = parser->pos;
 
-    if(user == NULL) {
-        return false;
+    *count = 0;
+
+    while(parser->pos < parser->end && *parser->pos >= '0' && *parser->pos <= '9' && parser->pos - start < 6) {
+        *count = *count * 10 + (*parser->pos++ - '0');
     }
-    *userId = user->pw_uid;
-    return true;
+    parser->unsupported = parser->unsupported || parser->pos == start;
+    return parser->pos != start;
 }
 
-// Checks if a userID exists in user database
-bool userIdExists(unsigned int userId) {
-    struct passwd* user = getpwuid(userId);
+// Allocates a node of the parse tree, REGEX_CLASS starts without characters
+RegexNode* createRegexNode(RegexParser* parser, RegexKind kind, RegexNode* left, RegexNode* right) {
+    RegexNode* node = (RegexNode*)allocateMemory(sizeof(RegexNode));
 
-    if(user == NULL) {
-        return false;
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    memset(node->accepts, 0, sizeof(node->accepts));
+    parser->nodes++;
+    return node;
+}
+
+// Copies a subtree for a counted repeat, every copy gets states of its own
+RegexNode* copyRegexNode(RegexParser* parser, const RegexNode* node) {
+    if(node == NULL) {
+        return NULL;
     }
-    return true;
+
+    RegexNode* copy = createRegexNode(parser, node->kind, copyRegexNode(parser, node->left), copyRegexNode(parser, node->right));
+
+    memcpy(copy->accepts, node->accepts, sizeof(copy->accepts));
+    return copy;
 }
 
-// Checks if a group exists in the group database
-bool groupExists(const char* groupName) {
-    struct group* grp = getgrnam(groupName);
+size_t countRegexNodes(const RegexNode* node) {
+    return node == NULL ? 0 : 1 + countRegexNodes(node->left) + countRegexNodes(node->right);
+}
 
-    if(grp == NULL) {
-        return false;
+// Counts the classes of a tree, each one becomes a state of the RegexNfa
+size_t countRegexClasses(const RegexNode* node) {
+    if(node == NULL) {
+        return 0;
     }
-    return true;
+    return (node->kind == REGEX_CLASS ? 1 : 0) + countRegexClasses(node->left) + countRegexClasses(node->right);
 }
 
-// Checks if a groupID exists in the group database
-bool groupIdExists(unsigned int groupId) {
-    struct group* grp = getgrgid(groupId);
+void freeRegexNode(RegexNode* node) {
+    if(node != NULL) {
+        freeRegexNode(node->left);
+        freeRegexNode(node->right);
+        free(node);
+    }
+}
 
-    if(grp == NULL) {
-        return false;
+/* Builds the position automaton of a parse tree: the states that may follow
+the start are the ones the expression can start with, the finals are the
+ones it can end with, and the start too if it matches the empty string. */
+RegexNfa* createRegexNfa(const RegexNode* root, size_t classes) {
+    RegexNfa* nfa = (RegexNfa*)allocateMemory(sizeof(RegexNfa));
+    size_t words = (classes + 1 + 63) / 64;
+    size_t next = 1;
+    uint64_t last[words];
+
+    nfa->words = words;
+    nfa->accepts = (uint64_t*)allocateMemory(sizeof(uint64_t) * words * (256 + classes + 3));
+    nfa->follows = nfa->accepts + words * 256;
+    nfa->starts = nfa->follows + words * (classes + 1);
+    nfa->finals = nfa->starts + words;
+    memset(nfa->accepts, 0, sizeof(uint64_t) * words * (256 + classes + 3));
+
+    nfa->starts[0] = 1;
+
+    if(linkRegexNode(nfa, root, &next, nfa->follows, last)) {
+        last[0] |= 1;
     }
-    return true;
+    memcpy(nfa->finals, last, sizeof(last));
+
+    initDfa(&nfa->dfa, stepRegex, nfa, words, nfa->starts, nfa->finals);
+    return nfa;
 }
 
-// Checks if a given type is allowed
-bool typeExists(const char* type) {
-    static char allowedTypes[7] = {'b', 'c', 'd', 'p', 'f', 'l', 's'};
+/* Numbers the classes of a subtree from next on and links their follows.
+Fills the states the subtree can start and end with, returns whether it
+matches the empty string. */
+bool linkRegexNode(RegexNfa* nfa, const RegexNode* node, size_t* next, uint64_t* first, uint64_t* last) {
+    size_t words = nfa->words;
+    uint64_t rightFirst[words];
+    uint64_t rightLast[words];
+    bool empty = false;
+    bool rightEmpty = false;
 
-    for(unsigned int i = 0; i < sizeof(allowedTypes); i++) {
-        if(type[0] == allowedTypes[i]) {
-            return true;
+    memset(first, 0, sizeof(uint64_t) * words);
+    memset(last, 0, sizeof(uint64_t) * words);
+
+    switch(node->kind) {
+        case REGEX_CLASS: {
+            size_t state = (*next)++;
+
+            for(int c = 0; c < 256; c++) {
+                if(node->accepts[c / 64] & (1ULL << (c % 64))) {
+                    nfa->accepts[c * words + state / 64] |= 1ULL << (state % 64);
+                }
+            }
+            first[state / 64] = last[state / 64] = 1ULL << (state % 64);
+            return false;
         }
+        case REGEX_EMPTY:
+            return true;
+        case REGEX_CONCAT:
+            empty = linkRegexNode(nfa, node->left, next, first, last);
+            rightEmpty = linkRegexNode(nfa, node->right, next, rightFirst, rightLast);
+
+            for(size_t state = 0; state < words * 64; state++) {
+                if(last[state / 64] & (1ULL << (state % 64))) {
+                    for(size_t w = 0; w < words; w++) {
+                        nfa->follows[state * words + w] |= rightFirst[w];
+                    }
+                }
+            }
+            for(size_t w = 0; w < words; w++) {
+                first[w] |= empty ? rightFirst[w] : 0;
+                last[w] = rightLast[w] | (rightEmpty ? last[w] : 0);
+            }
+            return empty && rightEmpty;
+        case REGEX_ALTERNATE:
+            empty = linkRegexNode(nfa, node->left, next, first, last);
+            rightEmpty = linkRegexNode(nfa, node->right, next, rightFirst, rightLast);
+
+            for(size_t w = 0; w < words; w++) {
+                first[w] |= rightFirst[w];
+                last[w] |= rightLast[w];
+            }
+            return empty || rightEmpty;
+        default:
+            linkRegexNode(nfa, node->left, next, first, last);
+
+            for(size_t state = 0; state < words * 64; state++) {
+                if(last[state / 64] & (1ULL << (state % 64))) {
+                    for(size_t w = 0; w < words; w++) {
+                        nfa->follows[state * words + w] |= first[w];
+                    }
+                }
+            }
+            return true;
     }
-    return false;
 }
 
-// Checks if a paramater could not be parsed
-void exitOnNull(Parameter* param, const char* paramName) {
-    if (param == NULL) {
-        fprintf(stderr, "Parameter %s could not be parsed.\n", paramName);
-        exit(EXIT_FAILURE);
+// Moves the states of a RegexNfa over one character
+void stepRegex(const void* automaton, const uint64_t* from, unsigned char c, uint64_t* to) {
+    const RegexNfa* nfa = (const RegexNfa*)automaton;
+    const uint64_t* accepts = &nfa->accepts[c * nfa->words];
+
+    memset(to, 0, sizeof(uint64_t) * nfa->words);
+
+    for(size_t w = 0; w < nfa->words; w++) {
+        for(uint64_t bits = from[w]; bits != 0; bits &= bits - 1) {
+            const uint64_t* follows = &nfa->follows[(w * 64 + (size_t)__builtin_ctzll(bits)) * nfa->words];
+
+            for(size_t v = 0; v < nfa->words; v++) {
+                to[v] |= follows[v];
+            }
+        }
+    }
+    for(size_t v = 0; v < nfa->words; v++) {
+        to[v] &= accepts[v];
     }
 }
 
-// Appends a paramater node to the parameter linked list
-ParameterNode* appendParameter(ParameterNode* head, Parameter* param) {
-    if(head == NULL || param  == NULL) {
-        return NULL;
+/* Finds the longest run of single characters the expression has to match one
+after the other, only looking through concatenations. Characters that are
+special to globs end a run, so the literal can be searched as a "*text*" glob.
+Runs are cut at GLOBMAXTOKENS characters. */
+void findRegexLiteral(const RegexNode* node, bool folded, char* run, size_t* runLength, char* best, size_t* bestLength) {
+    if(node->kind == REGEX_CONCAT) {
+        findRegexLiteral(node->left, folded, run, runLength, best, bestLength);
+        findRegexLiteral(node->right, folded, run, runLength, best, bestLength);
+        return;
     }
-
-    if(head->param == NULL) {
-        head->param = param;
-        head->next = NULL;
-        return head;
+    if(node->kind == REGEX_EMPTY) {
+        return;
     }
 
-    ParameterNode* current = head;
+    int single = -1;        // the lowest character of the class
+    size_t count = 0;
 
-    while(current->next != NULL) {
-        current = current->next;
+    for(int c = 1; c < 256 && node->kind == REGEX_CLASS; c++) {
+        if(node->accepts[c / 64] & (1ULL << (c % 64))) {
+            single = single < 0 ? c : single;
+            count++;
+        }
     }
 
-    current->next = (ParameterNode*)allocateMemory(sizeof(ParameterNode));
-    current->next->param = param;
-    current->next->next = NULL;
+    // Folded, a letter is accepted in both cases and searched for in lower case
+    bool letter = folded && count == 2 && isupper(single) && (node->accepts[(single + 32) / 64] & (1ULL << ((single + 32) % 64)));
+
+    single = letter ? foldCase((unsigned char)single) : single;
+
+    if((count != 1 && !letter) || single == '*' || single == '?' || single == '[') {
+        *runLength = 0;
+        return;
+    }
 
-    return head;
+    if(*runLength < GLOBMAXTOKENS) {
+        run[(*runLength)++] = (char)single;
+    }
+    if(*runLength > *bestLength) {
+        memcpy(best, run, *runLength);
+        *bestLength = *runLength;
+    }
 }
 
-// Creates a new parameter node with given parameters
-Parameter* createParameter(const char* name, const char* value) {
-    if(name == NULL) {
-        return NULL;
+// Matches a file name against all patterns of a NameSet, cheapest kinds first
+bool matchNameSet(const NameSet* set, const char* fileName) {
+    size_t length = strlen(fileName);
+
+    if(set->matchAll) {
+        return true;
     }
 
-    Parameter* param = (Parameter*)allocateMemory(sizeof(Parameter));
+    if(set->literals != NULL) {
+        uint64_t hash = hashBytes(fileName, length);
+        size_t slot = hash & set->literalMask;
 
-    param->name = (char*)allocateMemory(sizeof(char) * strlen(name + 1));
-    strcpy(param->name, name);
+        while(set->literals[slot] != NULL) {
+            if(set->literalHashes[slot] == hash && strcmp(set->literals[slot], fileName) == 0) {
+                return true;
+            }
+            slot = (slot + 1) & set->literalMask;
+        }
+    }
 
-    if(value != NULL) {
-        param->value = (char*)allocateMemory(sizeof(char) * strlen(value + 1));
-        strcpy(param->value, value);
+    if((set->suffixes != NULL && matchTrieEnd(set->suffixes, fileName, length, true)) ||
+       (set->prefixes != NULL && matchTrieEnd(set->prefixes, fileName, length, false)) ||
+       (set->contains != NULL && matchTrieAnywhere(set->contains, fileName, length)) ||
+       (set->globs != NULL && runDfa(&set->globs->dfa, fileName))) {
+        return true;
     }
 
-    return param;
+    for(size_t i = 0; i < set->otherCount; i++) {
+        if(compPath(&set->others[i], fileName)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-// Called for every entry to be tested
-void doEntry(const char* entry_name, ParameterNode* params) {
-    FileInfo* fi = (FileInfo*)allocateMemory(sizeof(FileInfo));
+// Walks a name into a trie of prefixes, or from its end into one of reversed suffixes
+bool matchTrieEnd(const NameTrie* trie, const char* name, size_t length, bool reversed) {
+    uint32_t node = 0;
 
-    errno = 0;
+    for(size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[reversed ? length - 1 - i : i];
 
-    ParameterNode* current = params;
-    bool flag = true;
+        node = trie->next[node * trie->columnCount + trie->columns[c]];
 
-    while((current != NULL) && flag) {
-        if(stat(entry_name, fi) != 0) {
-            switch (errno) {
-                case EACCES:
-                    fprintf(stdout, "stat(\"%s\") failed.\n", entry_name);
-                    break;
-                default:
-                    error(EXIT_FAILURE, errno, "stat(\"%s\") failed.\n", entry_name);
-                    break;
-            }
+        if(node == 0) {
+            return false;
         }
-
-        if(strcmp(current->param->name, "-print") == 0) {
-            printPath(entry_name);
-        } else if(strcmp(current->param->name, "-ls") == 0) {
-            printLs(entry_name, fi);
-        } else if(strcmp(current->param->name, "-user") == 0) {
-            flag &= compUser(fi, current->param->value);
-        } else if(strcmp(current->param->name, "-type") == 0) {
-            flag &= compType(fi, current->param->value[0]);
-        } else if(strcmp(current->param->name, "-name") == 0) {
-            flag &= compPath(current->param->value, entry_name);
+        if(trie->terminal[node]) {
+            return true;
         }
+    }
+    return false;
+}
+
+// Runs a name through an Aho-Corasick automaton, true as soon as any substring matched
+bool matchTrieAnywhere(const NameTrie* trie, const char* name, size_t length) {
+    uint32_t node = 0;
+
+    for(size_t i = 0; i < length; i++) {
+        node = trie->next[node * trie->columnCount + trie->columns[(unsigned char)name[i]]];
 
-        current = current->next;
+        if(trie->terminal[node]) {
+            return true;
+        }
     }
+    return false;
+}
 
-    if (S_ISDIR(fi->st_mode)) {
-        doDirectory(entry_name, params);
+// Matches a file name against a compiled pattern
+bool compPath(const NamePattern* name, const char* fileName) {
+    switch(name->kind) {
+        case MATCH_LITERAL:
+            return strcmp(name->text, fileName) == 0;
+        case MATCH_PREFIX:
+            return strncmp(name->text, fileName, name->length) == 0;
+        case MATCH_SUFFIX: {
+            // strlen and memcmp of glibc are vectorized already, a kernel of our own measured no faster
+            size_t length = strlen(fileName);
+
+            return length >= name->length && memcmp(fileName + length - name->length, name->text, name->length) == 0;
+        }
+        case MATCH_CONTAINS:
+            return containsKernel(fileName, name);
+        case MATCH_GLOB:
+            return runGlob(name->nfa, fileName);
+        case MATCH_FOLDED_CONTAINS:
+            return containsFoldedKernel(fileName, name);
+        case MATCH_FOLDED_LITERAL:
+            return strlen(fileName) == name->length && foldedEqualsKernel(fileName, name->text, name->length);
+        case MATCH_FOLDED_PREFIX:
+            return strnlen(fileName, name->length) == name->length && foldedEqualsKernel(fileName, name->text, name->length);
+        case MATCH_FOLDED_SUFFIX: {
+            size_t length = strlen(fileName);
+
+            return length >= name->length && foldedEqualsKernel(fileName + length - name->length, name->text, name->length);
+        }
+        case MATCH_FOLDED_FNMATCH:
+            return fnmatch(name->pattern, fileName, FNM_NOESCAPE | FNM_CASEFOLD) != FNM_NOMATCH;
+        default:
+            return fnmatch(name->pattern, fileName, FNM_NOESCAPE) != FNM_NOMATCH;
     }
+}
+
+/* Picks the name matching kernels for the CPU. SSE2 is part of x86-64, newer
+extensions are checked at runtime so one binary runs everywhere. For the
+substring search SSE4.2 is preferred over AVX2, most names are shorter than
+16 characters and fit into a single PCMPISTRI. AVX2 versions measured slower
+on real names for the same reason, 32 byte blocks hardly ever fill. */
+void selectKernels(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    foldedEqualsKernel = foldedEqualsSse2;
 
-    free(fi);
+    if(__builtin_cpu_supports("sse4.2")) {
+        containsKernel = containsSse42;
+        containsFoldedKernel = containsFoldedSse42;
+    }
+#endif
 }
 
-// Called for every directory to be tested
-void doDirectory(const char* dir_name, ParameterNode* params){
-    errno = 0;
-    DIR* dir = opendir(dir_name);
+// Checks if a string contains the fixed part of a pattern
+bool containsScalar(const char* str, const NamePattern* name) {
+    return memmem(str, strlen(str), name->text, name->length) != NULL;
+}
 
-    if(dir == NULL) {
-        switch(errno) {
-            case EACCES:
-                fprintf(stdout, "opendir(%s) failed.\n", dir_name);
-                break;
-            default: error(EXIT_FAILURE, errno, "opendir(%s) failed.\n", dir_name);
+/* Checks if a string contains the fixed part of a folded pattern. The
+comparison stops at the end of the string, which never equals a character
+of the text. */
+bool containsFoldedScalar(const char* str, const NamePattern* name) {
+    for(; *str != '\0'; str++) {
+        if(foldedEqualsScalar(str, name->text, name->length)) {
+            return true;
         }
     }
+    return name->length == 0;
+}
 
-    struct dirent* entry;
-
-    while((entry = readdir(dir)) != NULL) {
-        if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            char newPath[MAXPATHLENGTH];
-            concatPath(newPath, dir_name, entry->d_name);
-            doEntry(newPath, params);
+// Compares length characters of a string with lower, which is in lower case already, ignoring ASCII case
+bool foldedEqualsScalar(const char* str, const char* lower, size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        if(foldCase((unsigned char)str[i]) != (unsigned char)lower[i]) {
+            return false;
         }
     }
+    return true;
+}
+
+#if defined(__x86_64__)
+/* The vector kernels load whole blocks, which may reach past the end of a
+name. That is harmless as long as the block stays within one page, the bytes
+after the end are masked out. Otherwise the scalar version is used. */
+bool blockReadable(const void* ptr, size_t size) {
+    return ((uintptr_t)ptr & 4095) <= 4096 - size;
 }
 
-// Recreates functionality of "ls" command on CLI
-void printLs(const char* path, FileInfo* fileInfo) {
-    char timeStrBuff[13];
-    time_t time = fileInfo->st_mtim.tv_sec;
-    struct tm* lastModtime = localtime(&time);
+/* Searches 16 characters at a time with PCMPISTRI, which stops at the end of
+the name by itself. A match running over the end of a block is continued
+with the block starting at it. */
+__attribute__((target("sse4.2"), no_sanitize_address))
+bool containsSse42(const char* str, const NamePattern* name) {
+    size_t length = name->length;
 
-    strftime(timeStrBuff, 13, "%b %e %H:%M", lastModtime);
+    if(length > sizeof(name->block) || length == 0) {
+        return containsScalar(str, name);
+    }
 
-    errno = 0;
+    __m128i needle = _mm_loadu_si128((const __m128i*)name->block);
 
-    struct passwd* user = getpwuid(fileInfo->st_uid);
-    struct group* grp = getgrgid(fileInfo->st_gid);
+    while(true) {
+        if(!blockReadable(str, 16)) {
+            return containsScalar(str, name);
+        }
 
-    printf("%10lu", fileInfo->st_ino);
-    printf("%7ld", fileInfo->st_blocks / 2);
-    printf("%11s", getFilePermissions(fileInfo->st_mode));
-    printf("%4lu", fileInfo->st_nlink);
+        __m128i block = _mm_loadu_si128((const __m128i*)str);
+        int index = _mm_cmpistri(needle, block, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED);
 
-    if(user == NULL) {
-        printf("%11u", fileInfo->st_uid);
-    } else {
-        printf("%11s", user->pw_name);
+        if(index < 16 && (size_t)index + length <= 16) {
+            return true;
+        }
+        if(_mm_cmpistrz(needle, block, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED)) {
+            return false;
+        }
+        str += index;
     }
+}
 
-    if(grp == NULL) {
-        printf("%11u", fileInfo->st_gid);
-    } else {
-        printf("%11s", grp->gr_name);
+/* Like containsSse42(), with every block folded to lower case before it is
+searched. The text of folded patterns is in lower case already. */
+__attribute__((target("sse4.2"), no_sanitize_address))
+bool containsFoldedSse42(const char* str, const NamePattern* name) {
+    size_t length = name->length;
+
+    if(length > sizeof(name->block) || length == 0) {
+        return containsFoldedScalar(str, name);
     }
 
-    printf("%10ld", fileInfo->st_size);
-    printf("%13s", timeStrBuff);
-    printf(" %s", path);
+    __m128i needle = _mm_loadu_si128((const __m128i*)name->block);
 
-    printf("\n");
-}
+    while(true) {
+        if(!blockReadable(str, 16)) {
+            return containsFoldedScalar(str, name);
+        }
 
-// Prints a path
-void printPath(const char* path) {
-    fprintf(stdout, "%s\n", path);
-}
+        __m128i block = foldBlock(_mm_loadu_si128((const __m128i*)str));
+        int index = _mm_cmpistri(needle, block, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED);
 
-// Returns file permissions through mode_t flags
-char* getFilePermissions(mode_t mode) {
-    char* bits = malloc(sizeof(char) * 11);
+        if(index < 16 && (size_t)index + length <= 16) {
+            return true;
+        }
+        if(_mm_cmpistrz(needle, block, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED)) {
+            return false;
+        }
+        str += index;
+    }
+}
 
-    bits[0] = S_ISDIR(mode) ? 'd' : '-';
-    bits[1] = mode & S_IRUSR ? 'r' : '-';
-    bits[2] = mode & S_IWUSR ? 'w' : '-';
-    bits[3] = mode & S_IXUSR ? 'x' : '-';
-    bits[4] = mode & S_IRGRP ? 'r' : '-';
-    bits[5] = mode & S_IWGRP ? 'w' : '-';
-    bits[6] = mode & S_IXGRP ? 'x' : '-';
-    bits[7] = mode & S_IROTH ? 'r' : '-';
-    bits[8] = mode & S_IWOTH ? 'w' : '-';
-    bits[9] = mode & S_IXOTH ? 'x' : '-';
-    bits[10] = '\0';
+// Folds 16 characters to lower case by adding 0x20 to the bytes in 'A'..'Z'
+__m128i foldBlock(__m128i block) {
+    // Signed compare after moving 'A' to -128 selects exactly 'A'..'Z'
+    __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(block, _mm_set1_epi8((char)(0x80 - 'A'))), _mm_set1_epi8((char)(0x80 + 26)));
 
-    return bits;
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
 }
 
-// Concatenates two strings and adds a '/' between them
-void concatPath(char* dest, const char* arg1, const char* arg2) {
-    int pathLength = snprintf(dest, MAXPATHLENGTH, "%s/%s", arg1, arg2);
+// Folds 16 characters to lower case and compares them with lower, returns a bit for every character that is equal
+__attribute__((no_sanitize_address))
+unsigned int foldedMatch16(const char* str, const char* lower) {
+    __m128i folded = foldBlock(_mm_loadu_si128((const __m128i*)str));
 
-    if(pathLength >= MAXPATHLENGTH) {
-        error(EXIT_FAILURE, errno, "Maximum path length exceeded.\n");
-    }
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_loadu_si128((const __m128i*)lower)));
 }
 
-// Checks if a user matches with the user of the provided file
-bool compUser(const FileInfo* fi, const char* user) {
-    long userId = -1;
+/* Compares 16 characters at a time. The rest, which is most of a short name,
+is compared with one more block if that stays within the page. */
+__attribute__((no_sanitize_address))
+bool foldedEqualsSse2(const char* str, const char* lower, size_t length) {
+    size_t i = 0;
 
-    if(isNumeric(user) == true && strlen(user) < 19) {
-        if(strtol(user, NULL, 10) == 0) {
-            error(EXIT_FAILURE, 1, "Failed converting user ID.\n");
+    for(; i + 16 <= length; i += 16) {
+        if(foldedMatch16(str + i, lower + i) != 0xffff) {
+            return false;
         }
+    }
+
+    if(i < length && blockReadable(str + i, 16) && blockReadable(lower + i, 16)) {
+        unsigned int wanted = (1u << (length - i)) - 1;
 
-        return fi->st_uid == userId;
+        return (foldedMatch16(str + i, lower + i) & wanted) == wanted;
     }
+    return foldedEqualsScalar(str + i, lower + i, length - i);
+}
+#endif
 
-    errno = 0;
+/* Matches the path of an entry against a -path pattern. The directory part is
+the same for all entries of a directory, so the NFA state after it is kept in
+the frame of the directory and only the name is matched per entry. No state
+left rejects all entries of the directory, a reached final state that loops
+on a trailing '*' accepts all of them. fnmatch() patterns and the start path
+are matched as a whole. */
+bool matchPath(const Program* program, const PathTest* test, Entry* entry) {
+    const char* path = entryPath(entry);
+    const NamePattern* pattern = &test->pattern;
+    DirFrame* frame = walkStack;
+
+    if(pattern->nfa == NULL || entry->dirLength == STARTPATH || frame == NULL || frame->pathLength != entry->dirLength) {
+        return compPath(pattern, path);
+    }
 
-    struct passwd* pwd_user = getpwnam(user);
+    if(!frame->pathStatesReady) {
+        preparePathStates(program, frame);
+    }
+
+    const GlobNfa* nfa = pattern->nfa;
+    uint64_t state = frame->pathStates[test->slot];
 
-    if (pwd_user == NULL) {
-        error(EXIT_FAILURE, errno, "User does not exist.\n");
+    if(state == 0 || (state & nfa->final & nfa->loops) != 0) {
+        return state != 0;
     }
 
-    return fi->st_uid == pwd_user->pw_uid;
+    const char* name = path + entry->dirLength + 1;
+
+    return (advanceGlob(nfa, state, name, walkPath.length - entry->dirLength - 1) & nfa->final) != 0;
 }
 
-// Matches a file name against a pattern
-bool compPath(const char* name, const char* path) {
-    char* buff = strdup(path);
-    char* extractedFileName = basename(buff);
+/* Computes the -path states of a directory, from the states of its parent
+directory if they are known, which only adds the last component. */
+void preparePathStates(const Program* program, DirFrame* frame) {
+    const DirFrame* parent = frame->parentPath && frame->parent != NULL && frame->parent->pathStatesReady ? frame->parent : NULL;
+    size_t start = parent != NULL ? parent->pathLength + 1 : 0;
+
+    if(frame->pathStates == NULL) {
+        frame->pathStates = (uint64_t*)allocateMemory(sizeof(uint64_t) * program->pathTests);
+    }
+
+    for(size_t pc = 0; pc < program->length; pc++) {
+        const Instruction* instruction = &program->code[pc];
+
+        if(instruction->op == OP_PATH && instruction->arg.path.pattern.nfa != NULL) {
+            const GlobNfa* nfa = instruction->arg.path.pattern.nfa;
+            size_t slot = instruction->arg.path.slot;
+            uint64_t state = parent != NULL ? parent->pathStates[slot] : 1;
+
+            state = advanceGlob(nfa, state, walkPath.data + start, frame->pathLength - start);
+            frame->pathStates[slot] = advanceGlob(nfa, state, "/", 1);
+        } else if(instruction->op == OP_REGEX && instruction->arg.regex->nfa != NULL) {
+            // -1 where the DFA was full stays -1 for all subdirectories
+            LazyDfa* dfa = &instruction->arg.regex->nfa->dfa;
+            size_t slot = instruction->arg.regex->slot;
+            int state = parent != NULL ? (int)(int64_t)parent->pathStates[slot] : 1;
 
-    return fnmatch(name, extractedFileName, FNM_NOESCAPE ) != FNM_NOMATCH;
+            state = advanceDfa(dfa, state, walkPath.data + start, frame->pathLength - start);
+            frame->pathStates[slot] = (uint64_t)(int64_t)advanceDfa(dfa, state, "/", 1);
+        }
+    }
+    frame->pathStatesReady = true;
 }
 
-// Matches a path against a pattern
-bool matchPath(const char* pattern, const char* path) {
-    return fnmatch(pattern, path, FNM_NOESCAPE) != FNM_NOMATCH;
+/* Matches the path of an entry against a -regex expression like matchPath()
+does, running only the name on the DFA from the state after the directory.
+The whole path is matched where that state is unknown. */
+bool matchRegex(const Program* program, const RegexTest* test, Entry* entry) {
+    const char* path = entryPath(entry);
+    DirFrame* frame = walkStack;
+
+    if(test->nfa == NULL || entry->dirLength == STARTPATH || frame == NULL || frame->pathLength != entry->dirLength) {
+        return runRegex(test, path);
+    }
+
+    if(!frame->pathStatesReady) {
+        preparePathStates(program, frame);
+    }
+
+    LazyDfa* dfa = &test->nfa->dfa;
+    int state = (int)(int64_t)frame->pathStates[test->slot];
+
+    state = advanceDfa(dfa, state, path + entry->dirLength + 1, walkPath.length - entry->dirLength - 1);
+    return state >= 0 ? dfa->accepting[state] : runRegex(test, path);
 }
 
-/* Checks type of a file
-S_ISREG() - regular file
-S_ISDIR() - directory
-S_ISCHR() - character file
-S_ISBLK() - block file
-S_ISFIFO() - FIFO
-S_ISLINK() - symbolic link
-S_ISSOCK() - socket */
-bool compType(const FileInfo* fileInfo, char type) {
-    mode_t fileType = fileInfo->st_mode;
+/* Matches a whole path against a -regex expression. Paths without the literal
+of the prefilter are rejected by the substring kernels, which are much faster
+than the DFA and re_match(). Like in find the longest match at the start of
+the path has to cover all of it. */
+bool runRegex(const RegexTest* test, const char* path) {
+    size_t length = 0;
+
+    if(test->filtered && !compPath(&test->prefilter, path)) {
+        return false;
+    }
+    if(test->nfa != NULL) {
+        return runDfa(&test->nfa->dfa, path);
+    }
+    length = strlen(path);
+    return re_match(test->compiled, path, (regoff_t)length, 0, NULL) == (regoff_t)length;
+}
 
+/* Decodes a -type argument into file type bits
+S_IFREG - regular file
+S_IFDIR - directory
+S_IFCHR - character file
+S_IFBLK - block file
+S_IFIFO - FIFO
+S_IFLNK - symbolic link
+S_IFSOCK - socket */
+mode_t decodeType(char type) {
     switch (type) {
         case 'b':
-            return S_ISBLK(fileType);
+            return S_IFBLK;
         case 'c':
-            return S_ISCHR(fileType);
+            return S_IFCHR;
         case 'd':
-            return S_ISDIR(fileType);
+            return S_IFDIR;
         case 'p':
-            return S_ISFIFO(fileType);
+            return S_IFIFO;
         case 'f':
-            return S_ISREG(fileType);
+            return S_IFREG;
         case 'l':
-            return S_ISLNK(fileType);
+            return S_IFLNK;
         case 's':
-            return S_ISSOCK(fileType);
+            return S_IFSOCK;
         default:
-            return false;
+            return 0;
     }
 }
 
 // Checks if a file has a user
 bool hasNoUser(const FileInfo* fileInfo) {
-    return getpwuid(fileInfo->st_uid) == NULL;
+    return getpwuid(fileInfo->stx_uid) == NULL;
 }
 
 // Checks if malloc was successful
@@ -472,6 +4598,33 @@ bool stringStartsWith(const char *pre, const char *str) {
     return strncmp(pre, str, strlen(pre)) == 0;
 }
 
+/* Parses a size with an optional K, M or G suffix, eg.: "64K" -> 65536
+Returns false if the string is not a valid size. */
+bool parseSize(const char* str, size_t* size) {
+    char* end = NULL;
+
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if(errno != 0 || end == str || str[0] == '-') {
+        return false;
+    }
+
+    switch(*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        default: break;
+    }
+
+    if(*end != '\0') {
+        return false;
+    }
+
+    *size = (size_t)value;
+    return true;
+}
+
 // Checks if a string contains only numbers
 bool isNumeric(const char* str) {
     if(str == NULL) return false;